@@ -24,6 +24,9 @@ class LayoutElement
     int index;
     QRectF pos;
 
+    /// Where the element is in its page's children, 0 if it did not come from a template
+    int slot = 0;
+
     /// Returns true if this element is completely to the right of the other.
     /// The rectangles must overlap in the vertical axis.
     bool isToTheRightOf(const LayoutElement &other) const;
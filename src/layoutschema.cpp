@@ -0,0 +1,127 @@
+//  This file is part of LrtEdit.
+//
+// LrtEdit is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// LrtEdit is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LrtEdit.  If not, see <https://www.gnu.org/licenses/>.
+#include "layoutschema.h"
+#include "luaquery.h"
+#include "luaschema.h"
+
+#include <QDebug>
+
+#include <algorithm>
+
+using LuaParser::Field;
+using LuaParser::Value;
+
+namespace
+{
+/// An element, with what decides where it goes in the page
+struct Element
+{
+    LayoutElement layout;
+    QString placeholderType;
+    int photoIndex = 0;
+    int textIndex = 0;
+};
+
+constexpr Field<LayoutPage> pageFields[] = {
+    {"name", [](LayoutPage &lp, const Value &v) { lp.name = v.toString(); }, nullptr},
+    {"previewName", [](LayoutPage &lp, const Value &v) { lp.previewName = v.toString(); }, nullptr},
+    {"pageWidth", [](LayoutPage &lp, const Value &v) { lp.size.setWidth(v.toInt()); }, nullptr},
+    {"pageHeight", [](LayoutPage &lp, const Value &v) { lp.size.setHeight(v.toInt()); }, nullptr},
+};
+
+// The position is read as x then width, as setX() moves the left edge without moving the right
+constexpr Field<Element> elementFields[] = {
+    {"placeholderType", [](Element &e, const Value &v) { e.placeholderType = v.toString(); }, nullptr},
+    {"hints/photoIndex", [](Element &e, const Value &v) { e.photoIndex = v.toInt(); }, nullptr},
+    {"hints/textIndex", [](Element &e, const Value &v) { e.textIndex = v.toInt(); }, nullptr},
+    {"transform/x", [](Element &e, const Value &v) { e.layout.pos.setX(v.toDouble()); }, [](const Element &e) { return Value(e.layout.pos.x()); }},
+    {"transform/y", [](Element &e, const Value &v) { e.layout.pos.setY(v.toDouble()); }, [](const Element &e) { return Value(e.layout.pos.y()); }},
+    {"transform/width", [](Element &e, const Value &v) { e.layout.pos.setWidth(v.toDouble()); },
+     [](const Element &e) { return Value(e.layout.pos.width()); }},
+    {"transform/height", [](Element &e, const Value &v) { e.layout.pos.setHeight(v.toDouble()); },
+     [](const Element &e) { return Value(e.layout.pos.height()); }},
+};
+
+const LuaParser::Schema<Element> &elementSchema()
+{
+    static const LuaParser::Schema<Element> schema(elementFields);
+    return schema;
+}
+
+// Put an element in its place in photos or text, which may be in any order
+void place(QVector<LayoutElement> &elements, const LayoutElement &le)
+{
+    elements.resize(std::max(elements.size(), le.index));
+    elements[le.index - 1] = le;
+}
+}  // namespace
+
+LayoutPage LayoutSchema::readPage(const LuaParser::Table &page)
+{
+    static const LuaParser::Schema<LayoutPage> pageSchema(pageFields);
+    LayoutPage lp;
+    pageSchema.read(page, lp);
+
+    static const LuaParser::Query children("1/children/*");
+    for (const auto &match : children.matches(page))
+    {
+        if (match.value().table() == nullptr) continue;
+
+        Element e;
+        e.layout.slot = match.index(0);
+        elementSchema().read(*match.value().table(), e);
+
+        e.layout.index = e.placeholderType == "photo" ? e.photoIndex : e.placeholderType == "text" ? e.textIndex : 0;
+        if (e.layout.index < 1)
+        {
+            if (!e.placeholderType.isEmpty()) qWarning() << "No index for" << e.placeholderType << "element" << e.layout.slot << "of" << lp.name;
+            continue;
+        }
+        place(e.placeholderType == "photo" ? lp.photos : lp.text, e.layout);
+    }
+    return lp;
+}
+
+int LayoutSchema::writePage(const LayoutPage &lp, LuaParser::Table &page)
+{
+    // Written into a copy, which only replaces the page's children if something is different
+    static const LuaParser::Table::Path childrenPath("1/children");
+    const LuaParser::Value *found = page.find(childrenPath);
+    if (found == nullptr || found->table() == nullptr) return 0;
+    LuaParser::Table children = *found->table();
+
+    int written = 0;
+    Element e;
+    for (const QVector<LayoutElement> *elements : {&lp.photos, &lp.text})
+    {
+        for (const LayoutElement &le : *elements)
+        {
+            const LuaParser::Value *element = children.find(le.slot);
+            if (element == nullptr || element->table() == nullptr) continue;
+
+            LuaParser::Table table = *element->table();
+            e.layout = le;
+            const int changed = elementSchema().write(e, table);
+            if (changed > 0)
+            {
+                children[le.slot] = table;
+                written += changed;
+            }
+        }
+    }
+
+    if (written > 0) page.setAttr(childrenPath, children);
+    return written;
+}
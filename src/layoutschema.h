@@ -0,0 +1,34 @@
+//  This file is part of LrtEdit.
+//
+// LrtEdit is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// LrtEdit is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LrtEdit.  If not, see <https://www.gnu.org/licenses/>.
+#ifndef LAYOUTSCHEMA_H
+#define LAYOUTSCHEMA_H
+
+#include "layoutpage.h"
+#include "luatable.h"
+
+/// Maps the pages of a templatePages.lua onto LayoutPages, and back
+class LayoutSchema
+{
+   public:
+    /// Read a page (an item of the template's pages) with its photo and text elements
+    static LayoutPage readPage(const LuaParser::Table &page);
+
+    /// Write the element positions back to the children they were read from. Only values
+    /// which have changed are written, and page is left untouched if none have.
+    /// Returns the number of values changed.
+    static int writePage(const LayoutPage &lp, LuaParser::Table &page);
+};
+
+#endif // LAYOUTSCHEMA_H
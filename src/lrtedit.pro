@@ -4,7 +4,7 @@
 #
 #-------------------------------------------------
 
-QT       += core gui
+QT       += core gui concurrent
 
 greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
 
@@ -22,15 +22,27 @@ DEFINES += QT_DEPRECATED_WARNINGS
 # You can also select to disable deprecated APIs only up to a certain version of Qt.
 #DEFINES += QT_DISABLE_DEPRECATED_BEFORE=0x060000    # disables all the APIs deprecated before Qt 6.0.0
 
-CONFIG += c++11
+CONFIG += c++17
 
 SOURCES += \
         layoutelement.cpp \
         layoutpage.cpp \
         layoutpagemodel.cpp \
+        layoutschema.cpp \
+        luaarena.cpp \
+        luaatom.cpp \
+        luadiff.cpp \
         luagenerator.cpp \
+        luahistory.cpp \
+        lualexer.cpp \
+        luanumber.cpp \
         luaparser.cpp \
+        luapool.cpp \
+        luaquery.cpp \
+        luascanner.cpp \
+        luasnapshot.cpp \
         luatable.cpp \
+        luavalue.cpp \
         main.cpp \
         mainwindow.cpp \
         pageeditor.cpp \
@@ -40,9 +52,22 @@ HEADERS += \
         layoutelement.h \
         layoutpage.h \
         layoutpagemodel.h \
+        layoutschema.h \
+        luaarena.h \
+        luaatom.h \
+        luadiff.h \
         luagenerator.h \
+        luahistory.h \
+        lualexer.h \
+        luanumber.h \
         luaparser.h \
+        luapool.h \
+        luaquery.h \
+        luaschema.h \
+        luascanner.h \
+        luasnapshot.h \
         luatable.h \
+        luavalue.h \
         mainwindow.h \
         pageeditor.h \
         settingsdialog.h
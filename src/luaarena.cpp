@@ -0,0 +1,477 @@
+//  This file is part of LrtEdit.
+//
+// LrtEdit is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// LrtEdit is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LrtEdit.  If not, see <https://www.gnu.org/licenses/>.
+#include "luaarena.h"
+#include "luanumber.h"
+
+#include <QDebug>
+#include <QException>
+#include <QFile>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+namespace LuaParser
+{
+Arena::Arena(int blockSize) : m_blockSize(blockSize), m_next(nullptr), m_end(nullptr), m_size(0) {}
+
+Arena::~Arena()
+{
+    clear();
+}
+
+void *Arena::allocate(size_t size, size_t alignment)
+{
+    const size_t skip = static_cast<size_t>(-reinterpret_cast<quintptr>(m_next)) & (alignment - 1);
+    if (m_next == nullptr || skip + size > static_cast<size_t>(m_end - m_next))
+    {
+        // Big requests get a block of their own, so the current one can still be used up
+        const size_t blockSize = qMax(size + alignment, static_cast<size_t>(m_blockSize));
+        char *block = static_cast<char *>(malloc(blockSize));
+        if (block == nullptr) throw std::bad_alloc();
+        m_blocks.append(block);
+        m_size += static_cast<qint64>(size);
+
+        char *p = block + (static_cast<size_t>(-reinterpret_cast<quintptr>(block)) & (alignment - 1));
+        if (blockSize == static_cast<size_t>(m_blockSize))
+        {
+            m_next = p + size;
+            m_end = block + blockSize;
+        }
+        return p;
+    }
+
+    char *p = m_next + skip;
+    m_next = p + size;
+    m_size += static_cast<qint64>(size);
+    return p;
+}
+
+const char *Arena::copy(const char *begin, const char *end)
+{
+    const size_t size = static_cast<size_t>(end - begin);
+    char *p = static_cast<char *>(allocate(size, 1));
+    if (size > 0) memcpy(p, begin, size);
+    return p;
+}
+
+void Arena::clear()
+{
+    for (char *block : m_blocks) free(block);
+    m_blocks.clear();
+    m_next = nullptr;
+    m_end = nullptr;
+    m_size = 0;
+}
+
+
+/// A value, all of whose parts are in the arena
+struct ArenaDocument::Node
+{
+    Value::Kind kind;
+    int size;   ///< Bytes of text, or list items of a table
+    int named;  ///< Named entries of a table
+    union
+    {
+        bool b;
+        int i;
+        double d;  ///< Also the value of a Number
+    };
+    const char *text;  ///< UTF-8 of a string, or the lexeme of a Number
+    Node *children;    ///< List items, then named entries
+    const Atom *keys;  ///< Keys of the named entries
+
+    static Node of(Value::Kind kind)
+    {
+        Node n;
+        memset(&n, 0, sizeof(n));
+        n.kind = kind;
+        return n;
+    }
+};
+
+
+/// Collects each table's contents, then moves them into the arena in one piece when it ends
+class ArenaDocument::Builder : public EventHandler
+{
+   public:
+    explicit Builder(ArenaDocument &doc) : m_doc(doc), m_depth(0), m_hasKey(false) {}
+
+    void onTableBegin() override
+    {
+        // The frames are reused, so their buffers only grow to the biggest table at each depth
+        if (m_depth == m_frames.size()) m_frames.append(Frame());
+        Frame &frame = m_frames[m_depth++];
+        frame.key = m_key;
+        frame.hasKey = m_hasKey;
+        frame.items.clear();
+        frame.keys.clear();
+        frame.named.clear();
+        m_hasKey = false;
+    }
+
+    void onKey(const Span &name, bool escaped) override
+    {
+        if (m_depth == 0)
+            m_doc.m_name = name.toString();
+        else
+            m_key = escaped ? Atom(name.unescaped()) : Atom::fromUtf8(name.begin, name.end);
+        m_hasKey = true;
+    }
+
+    void onNumber(const Span &text, const Value &v) override
+    {
+        Node n = Node::of(v.kind());
+        if (v.kind() == Value::Kind::Int)
+            n.i = v.toInt();
+        else
+            n.d = v.toDouble();
+        if (v.kind() == Value::Kind::Number)
+        {
+            n.text = m_doc.m_arena.copy(text.begin, text.end);
+            n.size = text.size();
+        }
+        store(n);
+    }
+
+    void onString(const Span &text, bool zstr, bool escaped) override
+    {
+        Node n = Node::of(zstr ? Value::Kind::ZString : Value::Kind::String);
+        if (!escaped && memchr(text.begin, '\r', static_cast<size_t>(text.size())) == nullptr)
+        {
+            n.text = m_doc.m_arena.copy(text.begin, text.end);
+            n.size = text.size();
+        }
+        else
+        {
+            const QByteArray utf8 = (escaped ? text.unescaped() : text.toString()).toUtf8();
+            n.text = m_doc.m_arena.copy(utf8.constData(), utf8.constData() + utf8.size());
+            n.size = utf8.size();
+        }
+        store(n);
+    }
+
+    void onBool(bool value) override
+    {
+        Node n = Node::of(Value::Kind::Bool);
+        n.b = value;
+        store(n);
+    }
+
+    void onTableEnd() override
+    {
+        Frame &frame = m_frames[--m_depth];
+
+        Node n = Node::of(Value::Kind::Table);
+        n.size = frame.items.size();
+        n.named = frame.named.size();
+        n.children = m_doc.m_arena.allocate<Node>(n.size + n.named);
+        std::copy(frame.items.constBegin(), frame.items.constEnd(), n.children);
+        std::copy(frame.named.constBegin(), frame.named.constEnd(), n.children + n.size);
+        Atom *keys = m_doc.m_arena.allocate<Atom>(n.named);
+        std::copy(frame.keys.constBegin(), frame.keys.constEnd(), keys);
+        n.keys = keys;
+
+        m_key = frame.key;
+        m_hasKey = frame.hasKey;
+        store(n);
+    }
+
+   private:
+    void store(const Node &n)
+    {
+        if (m_depth == 0)
+        {
+            m_doc.m_root = m_doc.m_arena.allocate<Node>(1);
+            *m_doc.m_root = n;
+        }
+        else if (m_hasKey)
+        {
+            // As in a Table, a repeated key replaces the earlier value
+            Frame &frame = m_frames[m_depth - 1];
+            const int existing = frame.keys.indexOf(m_key);
+            if (existing >= 0)
+            {
+                frame.named[existing] = n;
+            }
+            else
+            {
+                frame.keys.append(m_key);
+                frame.named.append(n);
+            }
+        }
+        else
+        {
+            m_frames[m_depth - 1].items.append(n);
+        }
+
+        m_hasKey = false;
+    }
+
+    struct Frame
+    {
+        Atom key;
+        bool hasKey = false;
+        QVector<Node> items;
+        QVector<Atom> keys;
+        QVector<Node> named;
+    };
+
+    ArenaDocument &m_doc;
+    QVector<Frame> m_frames;
+    int m_depth;
+    Atom m_key;
+    bool m_hasKey;
+};
+
+
+ArenaDocument::ArenaDocument() : m_root(nullptr) {}
+
+bool ArenaDocument::open(const QString &path)
+{
+    clear();
+
+    QFile f(path);
+    if (!f.open(QIODevice::ReadOnly))
+    {
+        qCritical() << "Error opening file for reading:" << path;
+        return false;
+    }
+
+    qDebug() << "Read" << f.size() << "bytes from" << path;
+    return setData(f.readAll());
+}
+
+bool ArenaDocument::setData(const QByteArray &data)
+{
+    clear();
+
+    Builder builder(*this);
+    if (!parseLuaEvents(data.constData(), data.constData() + data.size(), builder) || m_root == nullptr)
+    {
+        clear();
+        return false;
+    }
+
+    return true;
+}
+
+void ArenaDocument::clear()
+{
+    m_root = nullptr;
+    m_name.clear();
+    m_arena.clear();
+}
+
+Value ArenaDocument::getAttr(const Table::Path &path) const
+{
+    return value(find(m_root, path));
+}
+
+QString ArenaDocument::getString(const QString &attr) const
+{
+    return getAttr(attr).toString();
+}
+
+int ArenaDocument::getInt(const QString &attr) const
+{
+    return getAttr(attr).toInt();
+}
+
+double ArenaDocument::getDouble(const QString &attr) const
+{
+    return getAttr(attr).toDouble();
+}
+
+Table ArenaDocument::getTable(const QString &attr) const
+{
+    return getAttr(attr).value<Table>();
+}
+
+ArenaDocument::View ArenaDocument::view(const Table::Path &path) const
+{
+    return View(this, findTable(m_root, path));
+}
+
+int ArenaDocument::getSequenceSize(const QString &attr) const
+{
+    const Node *n = find(m_root, Table::Path(attr));
+    return n->kind == Value::Kind::Table ? n->size : 0;
+}
+
+void ArenaDocument::setAttr(const Table::Path &path, const Value &value)
+{
+    fill(*const_cast<Node *>(find(m_root, path)), value);
+}
+
+NamedVariant ArenaDocument::namedVariant() const
+{
+    if (isEmpty()) return NamedVariant();
+
+    return NamedVariant(m_name, value(m_root).toVariant());
+}
+
+const ArenaDocument::Node *ArenaDocument::find(const Node *from, const Table::Path &path) const
+{
+    const Node *n = from;
+    for (int s = 0; n != nullptr && s < path.size(); s++)
+    {
+        const Table::Path::Segment &segment = path.at(s);
+        if (n->kind != Value::Kind::Table)
+        {
+            n = nullptr;
+        }
+        else if (segment.isIndex())
+        {
+            n = segment.index() <= n->size ? &n->children[segment.index() - 1] : nullptr;
+        }
+        else
+        {
+            const Atom *key = std::find(n->keys, n->keys + n->named, segment.key());
+            n = key != n->keys + n->named ? &n->children[n->size + (key - n->keys)] : nullptr;
+        }
+    }
+
+    if (n == nullptr)
+    {
+        qCritical() << "Invalid path '" + path.toString() + "' in document lookup.";
+        throw QException();
+    }
+    return n;
+}
+
+const ArenaDocument::Node *ArenaDocument::findTable(const Node *from, const Table::Path &path) const
+{
+    const Node *n = find(from, path);
+    if (n->kind != Value::Kind::Table)
+    {
+        qCritical() << "Path '" + path.toString() + "' in document lookup is not a table.";
+        throw QException();
+    }
+    return n;
+}
+
+void ArenaDocument::fill(Node &n, const Value &v)
+{
+    n = Node::of(v.kind());
+    switch (v.kind())
+    {
+        case Value::Kind::Bool:
+            n.b = v.toBool();
+            break;
+        case Value::Kind::Int:
+            n.i = v.toInt();
+            break;
+        case Value::Kind::Double:
+            n.d = v.toDouble();
+            break;
+        case Value::Kind::Number:
+        case Value::Kind::String:
+        case Value::Kind::ZString:
+        {
+            const QByteArray utf8 = v.text().toUtf8();
+            n.text = m_arena.copy(utf8.constData(), utf8.constData() + utf8.size());
+            n.size = utf8.size();
+            if (v.kind() == Value::Kind::Number) n.d = v.toDouble();
+            break;
+        }
+        case Value::Kind::Table:
+        {
+            const Table &t = *v.table();
+            n.size = t.hash();
+            n.named = t.atoms().size();
+            n.children = m_arena.allocate<Node>(n.size + n.named);
+            Atom *keys = m_arena.allocate<Atom>(n.named);
+
+            // Items then named entries, which is the order the children are kept in
+            int i = 0;
+            t.forEach([&](const Table::Entry &entry) {
+                if (entry.key != nullptr) keys[i - n.size] = *entry.key;
+                fill(n.children[i++], entry.value);
+            });
+            n.keys = keys;
+            break;
+        }
+        case Value::Kind::Null:
+            break;
+    }
+}
+
+Value ArenaDocument::value(const Node *n) const
+{
+    switch (n->kind)
+    {
+        case Value::Kind::Null:
+            return Value();
+        case Value::Kind::Bool:
+            return Value(n->b);
+        case Value::Kind::Int:
+            return Value(n->i);
+        case Value::Kind::Double:
+            return Value(n->d);
+        case Value::Kind::Number:
+            return Value(Number(n->d, QByteArray(n->text, n->size)));
+        case Value::Kind::String:
+        case Value::Kind::ZString:
+            return Value::fromUtf8(n->text, n->text + n->size, n->kind == Value::Kind::ZString);
+        case Value::Kind::Table:
+        {
+            Table t;
+            t.reserve(n->size, n->named);
+            for (int i = 0; i < n->size; i++) t.append(value(&n->children[i]));
+            for (int i = 0; i < n->named; i++) t[n->keys[i]] = value(&n->children[n->size + i]);
+            return Value(t);
+        }
+    }
+    return Value();
+}
+
+
+int ArenaDocument::View::size() const
+{
+    return m_node->size;
+}
+
+Value ArenaDocument::View::getAttr(const Table::Path &path) const
+{
+    return m_doc->value(m_doc->find(m_node, path));
+}
+
+QString ArenaDocument::View::getString(const QString &attr) const
+{
+    return getAttr(Table::Path(attr)).toString();
+}
+
+int ArenaDocument::View::getInt(const QString &attr) const
+{
+    return getAttr(Table::Path(attr)).toInt();
+}
+
+double ArenaDocument::View::getDouble(const QString &attr) const
+{
+    return getAttr(Table::Path(attr)).toDouble();
+}
+
+ArenaDocument::View ArenaDocument::View::getTable(const Table::Path &path) const
+{
+    return View(m_doc, m_doc->findTable(m_node, path));
+}
+
+Table ArenaDocument::View::toTable() const
+{
+    return m_doc->value(m_node).value<Table>();
+}
+
+};  // namespace LuaParser
@@ -0,0 +1,165 @@
+//  This file is part of LrtEdit.
+//
+// LrtEdit is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// LrtEdit is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LrtEdit.  If not, see <https://www.gnu.org/licenses/>.
+#ifndef LUAARENA_H
+#define LUAARENA_H
+
+#include "luaparser.h"
+
+#include <QByteArray>
+#include <QVector>
+
+#include <type_traits>
+
+namespace LuaParser
+{
+/// A bump allocator: memory is handed out from large blocks and only given back all at once.
+/// Nothing allocated from it is destroyed, so it only holds trivially destructible types.
+class Arena
+{
+   public:
+    explicit Arena(int blockSize = 64 * 1024);
+    ~Arena();
+
+    Arena(const Arena &) = delete;
+    Arena &operator=(const Arena &) = delete;
+
+    void *allocate(size_t size, size_t alignment);
+
+    template <typename T>
+    T *allocate(int count)
+    {
+        static_assert(std::is_trivially_destructible<T>::value, "Nothing in an arena is ever destroyed");
+        return static_cast<T *>(allocate(sizeof(T) * static_cast<size_t>(count), alignof(T)));
+    }
+
+    /// A copy of [begin, end), which is not null-terminated
+    const char *copy(const char *begin, const char *end);
+
+    /// Free every block at once
+    void clear();
+
+    /// Bytes handed out, and the number of blocks they came from
+    qint64 size() const { return m_size; }
+    int blockCount() const { return m_blocks.size(); }
+
+   private:
+    const int m_blockSize;
+    QVector<char *> m_blocks;
+    char *m_next;
+    char *m_end;
+    qint64 m_size;
+};
+
+
+/// A whole lua structure, with all its tables and strings in a single Arena.
+///
+/// Unlike a tree of Tables, loading one makes a handful of allocations however big the file
+/// is, and discarding it frees them in one go. Values are converted to Value as they are asked
+/// for, and can be replaced in place. Tables are read where they are through a View; a Table is
+/// only built (on the heap, and afresh each time) when one is asked for.
+class ArenaDocument
+{
+    struct Node;
+
+   public:
+    /// A table in the document, read where it is in the arena rather than copied out of it.
+    /// Cheap to copy, and valid until the document is discarded. It sees any values replaced
+    /// inside it since it was taken.
+    class View
+    {
+       public:
+        View() : m_doc(nullptr), m_node(nullptr) {}
+
+        bool isNull() const { return m_node == nullptr; }
+
+        /// Number of list items
+        int size() const;
+
+        /// As for ArenaDocument, relative to this table. A table comes back as a copy, which
+        /// getTable() avoids.
+        Value getAttr(const Table::Path &path) const;
+        QString getString(const QString &attr) const;
+        int getInt(const QString &attr) const;
+        double getDouble(const QString &attr) const;
+        View getTable(const Table::Path &path) const;
+
+        /// A copy of the whole table, on the heap
+        Table toTable() const;
+
+       private:
+        friend class ArenaDocument;
+        View(const ArenaDocument *doc, const Node *node) : m_doc(doc), m_node(node) {}
+
+        const ArenaDocument *m_doc;
+        const Node *m_node;
+    };
+
+    ArenaDocument();
+
+    /// Read and parse a file. Returns false if it could not be read or parsed.
+    bool open(const QString &path);
+
+    /// Parse some lua text, which is not needed afterwards. Returns false if it could not be parsed.
+    bool setData(const QByteArray &data);
+
+    /// Discard everything
+    void clear();
+
+    bool isEmpty() const { return m_root == nullptr; }
+
+    /// Name of the top-level variable
+    const QString &name() const { return m_name; }
+
+    /// Path-based accessors, as for Table (an empty path is the top-level value)
+    Value getAttr(const Table::Path &path) const;
+    Value getAttr(const QString &attr) const { return getAttr(Table::Path(attr)); }
+    QString getString(const QString &attr) const;
+    int getInt(const QString &attr) const;
+    double getDouble(const QString &attr) const;
+
+    /// A copy of a table, built on the heap each time it is asked for
+    Table getTable(const QString &attr) const;
+
+    /// The table at path (the top-level one for an empty path), without copying it out of the arena
+    View view(const Table::Path &path = Table::Path()) const;
+
+    /// Return the number of list elements for the Table specified by attr, without building it
+    int getSequenceSize(const QString &attr) const;
+
+    /// Replace an existing value, which can be of any kind (a table is copied into the arena).
+    /// Whatever it replaces stays in the arena until the document is discarded.
+    void setAttr(const Table::Path &path, const Value &value);
+
+    /// The whole structure, as readLuaStruct would have returned it, which copies all of it onto the heap
+    NamedVariant namedVariant() const;
+
+    const Arena &arena() const { return m_arena; }
+
+   private:
+    class Builder;
+
+    const Node *find(const Node *from, const Table::Path &path) const;
+    const Node *findTable(const Node *from, const Table::Path &path) const;
+    void fill(Node &node, const Value &value);
+    Value value(const Node *node) const;
+
+    Arena m_arena;
+    Node *m_root;
+    QString m_name;
+};
+
+};  // namespace LuaParser
+
+#endif // LUAARENA_H
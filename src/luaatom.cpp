@@ -0,0 +1,133 @@
+//  This file is part of LrtEdit.
+//
+// LrtEdit is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// LrtEdit is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LrtEdit.  If not, see <https://www.gnu.org/licenses/>.
+#include "luaatom.h"
+
+#include <QReadLocker>
+#include <QtAlgorithms>
+#include <QReadWriteLock>
+#include <QWriteLocker>
+
+namespace LuaParser
+{
+struct Atom::Entry
+{
+    QString text;
+    QByteArray utf8;
+};
+
+/// Every atom there has been. Entries are never removed, so an Atom never dangles.
+class Atom::Registry
+{
+   public:
+    ~Registry() { qDeleteAll(m_byUtf8); }
+
+    // Looked up with either form of the text, so neither has to be converted to the other.
+    // Each thread keeps the atoms it has found, so that once the keys of a file have been seen,
+    // parsing it (on however many threads) does not touch the lock at all.
+    const Entry *find(const QByteArray &utf8)
+    {
+        thread_local QHash<QByteArray, const Entry *> seen;
+        return find(seen, m_byUtf8, utf8, &Entry::utf8);
+    }
+
+    const Entry *find(const QString &text)
+    {
+        thread_local QHash<QString, const Entry *> seen;
+        return find(seen, m_byText, text, &Entry::text);
+    }
+
+    const Entry *add(const QString &text, const QByteArray &utf8)
+    {
+        QWriteLocker lock(&m_lock);
+
+        // Another thread may have added it since the lookup
+        const Entry *existing = m_byUtf8.value(utf8, nullptr);
+        if (existing != nullptr) return existing;
+
+        Entry *entry = new Entry{text, utf8};
+        m_byUtf8.insert(entry->utf8, entry);
+        m_byText.insert(entry->text, entry);
+        return entry;
+    }
+
+    int size()
+    {
+        QReadLocker lock(&m_lock);
+        return m_byUtf8.size();
+    }
+
+    static Registry &instance()
+    {
+        static Registry registry;
+        return registry;
+    }
+
+   private:
+    // Only what has been found is kept in seen, as an atom which is not there yet may be added later
+    template <typename Text>
+    const Entry *find(QHash<Text, const Entry *> &seen, const QHash<Text, Entry *> &all, const Text &text, Text Entry::*member)
+    {
+        const Entry *entry = seen.value(text, nullptr);
+        if (entry != nullptr) return entry;
+
+        {
+            QReadLocker lock(&m_lock);
+            entry = all.value(text, nullptr);
+        }
+
+        // Keyed on the entry's own copy, as text may only wrap the source
+        if (entry != nullptr) seen.insert(entry->*member, entry);
+        return entry;
+    }
+
+    QReadWriteLock m_lock;
+    QHash<QByteArray, Entry *> m_byUtf8;
+    QHash<QString, Entry *> m_byText;
+};
+
+
+Atom::Atom(const QString &text) : m_entry(Registry::instance().find(text))
+{
+    if (m_entry == nullptr) m_entry = Registry::instance().add(text, text.toUtf8());
+}
+
+Atom Atom::fromUtf8(const char *begin, const char *end)
+{
+    // Wraps the text for the lookup, it is only copied if this is a new atom
+    const QByteArray utf8 = QByteArray::fromRawData(begin, static_cast<int>(end - begin));
+    const Entry *entry = Registry::instance().find(utf8);
+    if (entry != nullptr) return Atom(entry);
+
+    const QByteArray copy(begin, static_cast<int>(end - begin));
+    return Atom(Registry::instance().add(QString::fromUtf8(copy), copy));
+}
+
+Atom Atom::find(const QString &text) { return Atom(Registry::instance().find(text)); }
+
+const QString &Atom::toString() const
+{
+    static const QString null;
+    return m_entry != nullptr ? m_entry->text : null;
+}
+
+const QByteArray &Atom::toUtf8() const
+{
+    static const QByteArray null;
+    return m_entry != nullptr ? m_entry->utf8 : null;
+}
+
+int Atom::count() { return Registry::instance().size(); }
+
+};  // namespace LuaParser
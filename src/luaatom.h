@@ -0,0 +1,72 @@
+//  This file is part of LrtEdit.
+//
+// LrtEdit is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// LrtEdit is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LrtEdit.  If not, see <https://www.gnu.org/licenses/>.
+#ifndef LUAATOM_H
+#define LUAATOM_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QString>
+
+namespace LuaParser
+{
+/// An interned table key. Each distinct key text is stored once for the life of the program,
+/// so templates which repeat the same few dozen keys on every page share them, and comparing
+/// or hashing atoms is a pointer operation. Safe to use from several threads, each of which
+/// remembers the atoms it has looked up, so interning a key seen before takes no lock.
+class Atom
+{
+   public:
+    /// The null atom, which is not the key of anything
+    Atom() : m_entry(nullptr) {}
+
+    /// Intern text, adding it if it has not been seen before
+    explicit Atom(const QString &text);
+
+    /// Intern UTF-8 text, only allocating if it has not been seen before
+    static Atom fromUtf8(const char *begin, const char *end);
+
+    /// Look up text without adding it, returning the null atom if it has never been interned
+    static Atom find(const QString &text);
+
+    bool isNull() const { return m_entry == nullptr; }
+
+    const QString &toString() const;
+    const QByteArray &toUtf8() const;
+
+    bool operator==(const Atom &other) const { return m_entry == other.m_entry; }
+    bool operator!=(const Atom &other) const { return m_entry != other.m_entry; }
+
+    /// An arbitrary (but consistent) order, for use as a QMap key. Use toString() to sort by name.
+    bool operator<(const Atom &other) const { return m_entry < other.m_entry; }
+
+    /// Number of distinct atoms, which is only really of interest to tests
+    static int count();
+
+   private:
+    struct Entry;
+    class Registry;
+
+    explicit Atom(const Entry *entry) : m_entry(entry) {}
+
+    const Entry *m_entry;
+
+    friend uint qHash(const Atom &atom, uint seed);
+};
+
+inline uint qHash(const Atom &atom, uint seed = 0) { return ::qHash(static_cast<const void *>(atom.m_entry), seed); }
+
+};  // namespace LuaParser
+
+#endif // LUAATOM_H
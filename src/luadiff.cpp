@@ -0,0 +1,60 @@
+//  This file is part of LrtEdit.
+//
+// LrtEdit is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// LrtEdit is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LrtEdit.  If not, see <https://www.gnu.org/licenses/>.
+#include "luadiff.h"
+
+namespace LuaParser
+{
+static void diff(const Table &before, const Table &after, const Table::Path &path, QVector<Change> &changes);
+
+static void diff(const Value &before, const Value &after, const Table::Path &path, QVector<Change> &changes)
+{
+    if (before.table() != nullptr && after.table() != nullptr)
+    {
+        diff(*before.table(), *after.table(), path, changes);
+    }
+    else if (!(before == after))
+    {
+        changes.append({Change::Changed, path, before, after});
+    }
+}
+
+static void diff(const Table &before, const Table &after, const Table::Path &path, QVector<Change> &changes)
+{
+    if (before.isSharedWith(after)) return;
+
+    // Tables from a reloaded document share nothing, but most are equal; the hashes are kept once worked out
+    if (before.contentHash() == after.contentHash() && before == after) return;
+
+    // Items and named entries alike are compared with whatever is at the same place in the other table
+    before.forEach([&](const Table::Entry &entry) {
+        const Value *value = after.find(entry.segment());
+        if (value != nullptr)
+            diff(entry.value, *value, path + Table::Path{entry.segment()}, changes);
+        else
+            changes.append({Change::Removed, path + Table::Path{entry.segment()}, entry.value, Value()});
+    });
+    after.forEach([&](const Table::Entry &entry) {
+        if (before.find(entry.segment()) == nullptr) changes.append({Change::Added, path + Table::Path{entry.segment()}, Value(), entry.value});
+    });
+}
+
+QVector<Change> diff(const Table &before, const Table &after)
+{
+    QVector<Change> changes;
+    diff(before, after, Table::Path(), changes);
+    return changes;
+}
+
+};  // namespace LuaParser
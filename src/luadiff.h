@@ -0,0 +1,50 @@
+//  This file is part of LrtEdit.
+//
+// LrtEdit is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// LrtEdit is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LrtEdit.  If not, see <https://www.gnu.org/licenses/>.
+#ifndef LUADIFF_H
+#define LUADIFF_H
+
+#include "luatable.h"
+
+#include <QVector>
+
+namespace LuaParser
+{
+/// One difference between two tables
+struct Change
+{
+    enum Kind
+    {
+        Added,
+        Removed,
+        Changed
+    };
+
+    Kind kind;
+    Table::Path path;
+    Value before;  ///< Null if it was added
+    Value after;   ///< Null if it was removed
+};
+
+/// What changed between before and after, as the values at the highest paths that differ.
+///
+/// List items are compared by position, so an item added to or removed from the end of a list
+/// is one change, but one inserted at the start changes every item after it. Tables which
+/// share their contents (because one is an unedited copy of the other, or of part of it) are
+/// not looked inside, so the cost follows the size of the change rather than of the tables.
+QVector<Change> diff(const Table &before, const Table &after);
+
+};  // namespace LuaParser
+
+#endif // LUADIFF_H
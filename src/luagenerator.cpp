@@ -13,6 +13,7 @@
 // You should have received a copy of the GNU General Public License
 // along with LrtEdit.  If not, see <https://www.gnu.org/licenses/>.
 #include "luagenerator.h"
+#include "luanumber.h"
 
 #include <QDebug>
 
@@ -23,77 +24,129 @@ LuaGenerator::LuaGenerator()
 
 static const int indentWidth = 4;
 
-QString LuaGenerator::Generate(const QVariant &value, int indent)
+// Quote a string so the lexer reads back exactly the same text
+static QString quoted(const QString &str)
 {
     QString s;
-    //= QString(indent, '\t');
-
-    if (value.type() == static_cast<QVariant::Type>(QMetaType::QString))
+    s.reserve(str.size() + 2);
+    s += '"';
+    for (const QChar c : str)
     {
-        const QString str = value.value<QString>();
-        if (str.startsWith("ZSTR:"))
-        {
-            s += " ZSTR \"" + str.mid(5) + '"';
-        }
-        else
+        switch (c.unicode())
         {
-            s += '"' + str + '"';
+            case '"':
+                s += "\\\"";
+                break;
+            case '\\':
+                s += "\\\\";
+                break;
+            case '\n':
+                s += "\\n";
+                break;
+            case '\r':
+                s += "\\r";
+                break;
+            default:
+                s += c;
+                break;
         }
     }
-    else if (value.type() == static_cast<QVariant::Type>(QMetaType::Int))
+    s += '"';
+    return s;
+}
+
+// Keys which are not plain identifiers have to be written as ["key"], as do lua's reserved words
+static bool isIdentifier(const QString &key)
+{
+    static const char *const reserved[] = {"and", "break", "do", "else", "elseif", "end", "false", "for", "function", "goto", "if",
+                                           "in", "local", "nil", "not", "or", "repeat", "return", "then", "true", "until", "while"};
+
+    if (key.isEmpty() || key[0].isDigit()) return false;
+    for (const QChar c : key)
     {
-        const int i = value.value<int>();
-        s += QString::number(i);
+        const ushort u = c.unicode();
+        if (!((u >= 'a' && u <= 'z') || (u >= 'A' && u <= 'Z') || (u >= '0' && u <= '9') || u == '_')) return false;
     }
-    else if (value.type() == static_cast<QVariant::Type>(QMetaType::Double))
+    for (const char *word : reserved)
     {
-        const double d = value.value<double>();
-        // A double has 15 digits of precision, so allow all of them to be printed
-        s += QString::number(d, 'g', 15);
+        if (key == QLatin1String(word)) return false;
     }
-    else if (value.type() == static_cast<QVariant::Type>(QMetaType::Bool))
+    return true;
+}
+
+QString LuaGenerator::Generate(const QVariant &value, int indent)
+{
+    return Generate(LuaParser::Value::fromVariant(value), indent);
+}
+
+QString LuaGenerator::Generate(const LuaParser::Value &value, int indent)
+{
+    using Kind = LuaParser::Value::Kind;
+
+    QString s;
+    //= QString(indent, '\t');
+
+    switch (value.kind())
     {
-        const bool b = value.value<bool>();
-        if (b)
+        case Kind::String:
+            s += quoted(value.text());
+            break;
+        case Kind::ZString:
+            s += " ZSTR " + quoted(value.text());
+            break;
+        case Kind::Int:
+            s += QString::number(value.toInt());
+            break;
+        case Kind::Double:
         {
-            s += "true";
+            // A double has 15 digits of precision, so allow all of them to be printed
+            char buffer[LuaParser::formatDoubleSize];
+            s += QString::fromLatin1(buffer, LuaParser::formatDouble(value.toDouble(), buffer));
+            break;
         }
-        else
+        case Kind::Number:
+            // Unchanged since it was read, so write it back exactly as it was
+            s += value.text();
+            break;
+        case Kind::Bool:
+            if (value.toBool())
+            {
+                s += "true";
+            }
+            else
+            {
+                s += "false";
+            }
+            break;
+        case Kind::Table:
         {
-            s += "false";
-        }
-    }
-    else if (value.canConvert<LuaParser::Table>())
-    {
-        const LuaParser::Table t = value.value<LuaParser::Table>();
+            const LuaParser::Table &t = *value.table();
 
-        s += "{\n";
+            s += "{\n";
 
-        // Print all list items
-        for (int i = 1; i <= t.hash(); i++)
-        {
-            s += QString(indent, ' ') + Generate(t[i], indent + indentWidth);
-            s += ",\n";
-        }
+            // Print all list items, then all named items
+            t.forEach([&](const LuaParser::Table::Entry &entry) {
+                s += QString(indent, ' ');
+                if (entry.key != nullptr)
+                {
+                    const QString &k = entry.key->toString();
+                    if (k.startsWith("hardcover_image"))
+                    {
+                        qDebug() << entry.value.toString();
+                    }
+                    s += (isIdentifier(k) ? k : "[" + quoted(k) + "]") + " = ";
+                }
+                s += Generate(entry.value, indent + indentWidth);
+                s += ",\n";
+            });
 
-        // Print all named items
-        const auto keys = t.keys();
-        for (auto k : keys)
-        {
-            if (k.startsWith("hardcover_image"))
-            {
-                qDebug() << t[k];
-            }
-            s += QString(indent, ' ') + k + " = " + Generate(t[k], indent + indentWidth);
-            s += ",\n";
+            s += QString(indent - indentWidth, ' ') + "}";
+            // s += "}";
+            break;
         }
-
-        s += QString(indent - indentWidth, ' ') + "}";
-        // s += "}";
-    }
-    else
-    {
-        s += "<unknown>";
+        case Kind::Null:
+            s += "<unknown>";
+            break;
     }
 
     return s;
@@ -112,5 +165,5 @@ QString LuaGenerator::Generate(const LuaParser::NamedVariant &nv, int indent)
 
 QString LuaGenerator::Generate(const LuaParser::Table &table, int indent)
 {
-    return Generate(QVariant::fromValue(table), indent);
+    return Generate(LuaParser::Value(table), indent);
 }
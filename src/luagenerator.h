@@ -25,6 +25,8 @@ class LuaGenerator
 
     static QString Generate(const QVariant &value, int indent = 0);
 
+    static QString Generate(const LuaParser::Value &value, int indent = 0);
+
     static QString Generate(const LuaParser::NamedVariant &nv, int indent = 0);
 
     static QString Generate(const LuaParser::Table &table, int indent = 0);
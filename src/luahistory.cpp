@@ -0,0 +1,132 @@
+//  This file is part of LrtEdit.
+//
+// LrtEdit is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// LrtEdit is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LrtEdit.  If not, see <https://www.gnu.org/licenses/>.
+#include "luahistory.h"
+#include "luadiff.h"
+
+#include <algorithm>
+
+namespace LuaParser
+{
+static Table::Path parentOf(const Table::Path &path)
+{
+    Table::Path parent;
+    for (int i = 0; i + 1 < path.size(); i++) parent << path.at(i);
+    return parent;
+}
+
+static bool isInside(const Table::Path &path, const Table::Path &table)
+{
+    if (path.size() <= table.size()) return false;
+    for (int i = 0; i < table.size(); i++)
+    {
+        if (!(path.at(i) == table.at(i))) return false;
+    }
+    return true;
+}
+
+
+TableHistory::TableHistory(const Table &initial) : m_current(initial), m_position(0)
+{
+}
+
+TableHistory::Step TableHistory::step(const Table &before, const Table &after)
+{
+    Step s;
+    const QVector<Change> changes = diff(before, after);
+
+    // Tables which gained or lost entries are set whole, and anything inside them with them
+    QVector<Table::Path> resized;
+    for (const Change &change : changes)
+    {
+        if (change.kind == Change::Changed) continue;
+
+        const Table::Path parent = parentOf(change.path);
+        if (parent.isEmpty())
+        {
+            s.whole = true;
+            s.before = before;
+            s.after = after;
+            return s;
+        }
+        if (!resized.contains(parent)) resized.append(parent);
+    }
+
+    for (const Table::Path &path : resized)
+    {
+        s.undo.set(path, before.getAttr(path));
+        s.redo.set(path, after.getAttr(path));
+    }
+    for (const Change &change : changes)
+    {
+        if (change.kind != Change::Changed) continue;
+
+        const auto inside = [&](const Table::Path &table) { return isInside(change.path, table); };
+        if (std::any_of(resized.constBegin(), resized.constEnd(), inside)) continue;
+
+        s.undo.set(change.path, change.before);
+        s.redo.set(change.path, change.after);
+    }
+    return s;
+}
+
+void TableHistory::push(const Table &version)
+{
+    m_steps.resize(m_position);
+    m_steps.append(step(m_current, version));
+    m_position++;
+    m_current = version;
+}
+
+const Table &TableHistory::undo()
+{
+    if (canUndo())
+    {
+        const Step &s = m_steps.at(--m_position);
+        if (s.whole)
+            m_current = s.before;
+        else
+            m_current.apply(s.undo);
+    }
+    return m_current;
+}
+
+const Table &TableHistory::redo()
+{
+    if (canRedo())
+    {
+        const Step &s = m_steps.at(m_position++);
+        if (s.whole)
+            m_current = s.after;
+        else
+            m_current.apply(s.redo);
+    }
+    return m_current;
+}
+
+void TableHistory::reset(const Table &initial)
+{
+    m_current = initial;
+    m_steps.clear();
+    m_position = 0;
+}
+
+int TableHistory::valueCount() const
+{
+    int n = 0;
+    for (const Step &s : m_steps) n += s.whole ? 2 : s.undo.size() + s.redo.size();
+    return n;
+}
+
+};  // namespace LuaParser
@@ -0,0 +1,81 @@
+//  This file is part of LrtEdit.
+//
+// LrtEdit is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// LrtEdit is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LrtEdit.  If not, see <https://www.gnu.org/licenses/>.
+#ifndef LUAHISTORY_H
+#define LUAHISTORY_H
+
+#include "luatable.h"
+
+#include <QVector>
+
+namespace LuaParser
+{
+/// Versions of a table, for undo and redo.
+///
+/// Only the current version is kept whole. Each step between versions is kept as the values
+/// which changed, found with diff(), set at their paths with Table::apply() to move either way.
+/// So a step costs the length of the paths and the size of the values which changed, e.g. one
+/// number and its seven-segment path for a moved element, however big the table is. Entries
+/// can only be set, not added or removed, so a table which gains or loses entries is kept
+/// whole in the step (shared with the version it came from, rather than copied).
+class TableHistory
+{
+   public:
+    explicit TableHistory(const Table &initial = Table());
+
+    /// The version undo() and redo() move from
+    const Table &current() const { return m_current; }
+
+    /// Add a version after the current one, which can then no longer be redone
+    void push(const Table &version);
+
+    bool canUndo() const { return m_position > 0; }
+    bool canRedo() const { return m_position < m_steps.size(); }
+
+    /// Move to the version before or after the current one, and return it
+    const Table &undo();
+    const Table &redo();
+
+    /// Forget every version, starting again from initial
+    void reset(const Table &initial);
+
+    /// Number of versions kept, including the current one
+    int size() const { return m_steps.size() + 1; }
+
+    /// Number of values kept for the steps between versions, which is only really of interest to tests
+    int valueCount() const;
+
+   private:
+    /// The edits which go from one version to the next, and back
+    struct Step
+    {
+        Table::Edits undo;
+        Table::Edits redo;
+
+        // The top-level table gained or lost entries, so both versions are kept
+        bool whole = false;
+        Table before;
+        Table after;
+    };
+
+    static Step step(const Table &before, const Table &after);
+
+    Table m_current;
+    QVector<Step> m_steps;
+    int m_position;  ///< Number of steps m_current is from the first version
+};
+
+};  // namespace LuaParser
+
+#endif // LUAHISTORY_H
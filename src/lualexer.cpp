@@ -0,0 +1,400 @@
+//  This file is part of LrtEdit.
+//
+// LrtEdit is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// LrtEdit is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LrtEdit.  If not, see <https://www.gnu.org/licenses/>.
+#include "lualexer.h"
+
+#include <cstring>
+
+namespace LuaParser
+{
+namespace
+{
+// Plain comparisons rather than <cctype>, which is locale-aware and shows up in profiles
+inline bool isSpace(char c) { return c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == '\v' || c == '\f'; }
+
+inline bool isDigit(char c) { return c >= '0' && c <= '9'; }
+
+inline bool isIdentifierStart(char c) { return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_'; }
+
+inline bool isIdentifierChar(char c) { return isIdentifierStart(c) || isDigit(c); }
+
+inline bool isHexDigit(char c) { return isDigit(c) || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F'); }
+
+inline int hexValue(char c) { return isDigit(c) ? c - '0' : (c | 0x20) - 'a' + 10; }
+
+// Append a code point as UTF-8, for "\u{XXX}" escapes
+void appendUtf8(QByteArray &out, uint code)
+{
+    if (code < 0x80)
+    {
+        out.append(static_cast<char>(code));
+    }
+    else if (code < 0x800)
+    {
+        out.append(static_cast<char>(0xC0 | (code >> 6)));
+        out.append(static_cast<char>(0x80 | (code & 0x3F)));
+    }
+    else if (code < 0x10000)
+    {
+        out.append(static_cast<char>(0xE0 | (code >> 12)));
+        out.append(static_cast<char>(0x80 | ((code >> 6) & 0x3F)));
+        out.append(static_cast<char>(0x80 | (code & 0x3F)));
+    }
+    else
+    {
+        out.append(static_cast<char>(0xF0 | (code >> 18)));
+        out.append(static_cast<char>(0x80 | ((code >> 12) & 0x3F)));
+        out.append(static_cast<char>(0x80 | ((code >> 6) & 0x3F)));
+        out.append(static_cast<char>(0x80 | (code & 0x3F)));
+    }
+}
+}  // namespace
+
+
+int longBracketLevel(const char *p, const char *end)
+{
+    if (p == end || *p != '[') return -1;
+
+    const char *q = p + 1;
+    while (q != end && *q == '=') q++;
+    return q != end && *q == '[' ? static_cast<int>(q - p - 1) : -1;
+}
+
+const char *findLongBracketClose(const char *p, const char *end, int level)
+{
+    for (;;)
+    {
+        p = static_cast<const char *>(memchr(p, ']', static_cast<size_t>(end - p)));
+        if (p == nullptr) return nullptr;
+
+        const char *q = p + 1;
+        while (q != end && *q == '=') q++;
+        if (q != end && *q == ']' && q - p - 1 == level) return p;
+
+        p++;
+    }
+}
+
+
+bool Span::equals(const char *literal) const
+{
+    const size_t n = strlen(literal);
+    return n == static_cast<size_t>(size()) && memcmp(begin, literal, n) == 0;
+}
+
+
+QString Span::toString() const
+{
+    // Files are read in binary, so drop the '\r' of any CRLF line endings as a Text mode read would have done
+    const char *cr = isEmpty() ? nullptr : static_cast<const char *>(memchr(begin, '\r', static_cast<size_t>(size())));
+    if (cr == nullptr) return QString::fromUtf8(begin, size());
+
+    QByteArray text;
+    text.reserve(size());
+    const char *from = begin;
+    while (cr != nullptr)
+    {
+        const bool crlf = cr + 1 != end && cr[1] == '\n';
+        text.append(from, static_cast<int>(cr - from) + (crlf ? 0 : 1));
+        from = cr + 1;
+        cr = static_cast<const char *>(memchr(from, '\r', static_cast<size_t>(end - from)));
+    }
+    text.append(from, static_cast<int>(end - from));
+
+    return QString::fromUtf8(text);
+}
+
+
+QString Span::unescaped() const
+{
+    // See https://www.lua.org/manual/5.3/manual.html#3.1
+    QByteArray text;
+    text.reserve(size());
+
+    const char *p = begin;
+    while (p != end)
+    {
+        const char *backslash = static_cast<const char *>(memchr(p, '\\', static_cast<size_t>(end - p)));
+        if (backslash == nullptr) backslash = end;
+        text.append(p, static_cast<int>(backslash - p));
+        if (backslash == end) break;
+
+        p = backslash + 1;
+        if (p == end) break;
+
+        const char c = *p++;
+        switch (c)
+        {
+            case 'a': text.append('\a'); break;
+            case 'b': text.append('\b'); break;
+            case 'f': text.append('\f'); break;
+            case 'n': text.append('\n'); break;
+            case 'r': text.append('\r'); break;
+            case 't': text.append('\t'); break;
+            case 'v': text.append('\v'); break;
+            case '\r':
+                // An escaped line break, in whichever style
+                if (p != end && *p == '\n') p++;
+                text.append('\n');
+                break;
+            case 'z':
+                while (p != end && isSpace(*p)) p++;
+                break;
+            case 'x':
+            {
+                int value = 0;
+                for (int i = 0; i < 2 && p != end && isHexDigit(*p); i++) value = value * 16 + hexValue(*p++);
+                text.append(static_cast<char>(value));
+                break;
+            }
+            case 'u':
+            {
+                uint code = 0;
+                if (p != end && *p == '{') p++;
+                while (p != end && isHexDigit(*p)) code = code * 16 + static_cast<uint>(hexValue(*p++));
+                if (p != end && *p == '}') p++;
+                appendUtf8(text, code);
+                break;
+            }
+            default:
+                if (isDigit(c))
+                {
+                    // Up to three decimal digits
+                    int value = c - '0';
+                    for (int i = 0; i < 2 && p != end && isDigit(*p); i++) value = value * 10 + (*p++ - '0');
+                    text.append(static_cast<char>(value));
+                }
+                else
+                {
+                    // Quotes, backslashes and line breaks stand for themselves
+                    text.append(c);
+                }
+                break;
+        }
+    }
+
+    return QString::fromUtf8(text);
+}
+
+
+Lexer::Lexer(const char *begin, const char *end) : m_begin(begin), m_cur(begin), m_end(end), m_hasPeeked(false), m_structure(nullptr) {}
+
+Token Lexer::next()
+{
+    if (m_hasPeeked)
+    {
+        m_hasPeeked = false;
+        return m_peeked;
+    }
+
+    return scan();
+}
+
+const Token &Lexer::peek()
+{
+    if (!m_hasPeeked)
+    {
+        m_peeked = scan();
+        m_hasPeeked = true;
+    }
+
+    return m_peeked;
+}
+
+long long Lexer::offset() const
+{
+    const char *p = m_hasPeeked ? m_peeked.text.begin : m_cur;
+    return p - m_begin;
+}
+
+void Lexer::seek(const char *p)
+{
+    m_cur = p;
+    m_hasPeeked = false;
+}
+
+Token Lexer::scan()
+{
+    for (;;)
+    {
+        while (m_cur != m_end && isSpace(*m_cur)) m_cur++;
+
+        if (m_end - m_cur >= 2 && m_cur[0] == '-' && m_cur[1] == '-')
+        {
+            // "--[[ ]]" comments (with any level of long bracket) may span lines
+            const int level = longBracketLevel(m_cur + 2, m_end);
+            if (level >= 0)
+            {
+                const char *close = findLongBracketClose(m_cur + 2 + level + 2, m_end, level);
+                if (close == nullptr)
+                {
+                    const char *start = m_cur;
+                    m_cur = m_end;
+                    return Token(Token::Invalid, Span(start, m_end));
+                }
+                m_cur = close + level + 2;
+                continue;
+            }
+
+            // Otherwise skip up to the end of the line
+            const char *eol = static_cast<const char *>(memchr(m_cur, '\n', static_cast<size_t>(m_end - m_cur)));
+            m_cur = eol ? eol + 1 : m_end;
+            continue;
+        }
+
+        break;
+    }
+
+    if (m_cur == m_end) return Token(Token::EndOfInput, Span(m_cur, m_cur));
+
+    const char *start = m_cur;
+    const char c = *m_cur++;
+
+    switch (c)
+    {
+        case '{':
+            return Token(Token::OpenBrace, Span(start, m_cur));
+        case '}':
+            return Token(Token::CloseBrace, Span(start, m_cur));
+        case '=':
+            return Token(Token::Equals, Span(start, m_cur));
+        case ',':
+        case ';':
+            return Token(Token::Comma, Span(start, m_cur));
+        case ']':
+            return Token(Token::CloseBracket, Span(start, m_cur));
+        case '[':
+        {
+            const int level = longBracketLevel(start, m_end);
+            if (level >= 0) return longString(start, level);
+            return Token(Token::OpenBracket, Span(start, m_cur));
+        }
+        case '"':
+        case '\'':
+            return quotedString(start, c);
+        default:
+            break;
+    }
+
+    if (isDigit(c) || c == '.' || c == '-') return number(start);
+
+    if (isIdentifierStart(c))
+    {
+        while (m_cur != m_end && isIdentifierChar(*m_cur)) m_cur++;
+        return Token(Token::Identifier, Span(start, m_cur));
+    }
+
+    return Token(Token::Invalid, Span(start, m_cur));
+}
+
+Token Lexer::quotedString(const char *start, char quote)
+{
+    bool escaped = false;
+
+    // Usually there is nothing to unescape, so the closing quote is found with a single memchr
+    const char *from = m_cur;
+    for (;;)
+    {
+        const char *close = static_cast<const char *>(memchr(from, quote, static_cast<size_t>(m_end - from)));
+        if (close == nullptr) break;
+
+        const char *backslash = static_cast<const char *>(memchr(from, '\\', static_cast<size_t>(close - from)));
+        if (backslash == nullptr)
+        {
+            m_cur = close + 1;
+            Token token(Token::String, Span(start + 1, close));
+            token.start = start;
+            token.escaped = escaped;
+            return token;
+        }
+
+        // Skip the escaped character, which may be the quote
+        escaped = true;
+        from = backslash + 2;
+        if (from > m_end) break;
+    }
+
+    m_cur = m_end;
+    return Token(Token::Invalid, Span(start, m_end));
+}
+
+Token Lexer::longString(const char *start, int level)
+{
+    const char *open = start + level + 2;
+    const char *close = findLongBracketClose(open, m_end, level);
+    if (close == nullptr)
+    {
+        m_cur = m_end;
+        return Token(Token::Invalid, Span(start, m_end));
+    }
+
+    // A line break straight after the opening bracket is not part of the string
+    if (open != close && (*open == '\n' || *open == '\r'))
+    {
+        const char first = *open++;
+        if (open != close && (*open == '\n' || *open == '\r') && *open != first) open++;
+    }
+
+    m_cur = close + level + 2;
+    Token token(Token::String, Span(open, close));
+    token.start = start;
+    return token;
+}
+
+Token Lexer::number(const char *start)
+{
+    // Only what lua itself would read as a number, so that text such as "12abc", "1.2.3" or
+    // a hex float is an Invalid token rather than something which converts to nothing
+    const char *p = start;
+    if (*p == '-') p++;
+
+    int digits = 0;
+    if (m_end - p >= 2 && p[0] == '0' && (p[1] | 0x20) == 'x')
+    {
+        for (p += 2; p != m_end && isHexDigit(*p); p++) digits++;
+    }
+    else
+    {
+        for (; p != m_end && isDigit(*p); p++) digits++;
+        if (p != m_end && *p == '.')
+        {
+            for (p++; p != m_end && isDigit(*p); p++) digits++;
+        }
+
+        // Exponents may be signed, but must have digits
+        if (digits > 0 && p != m_end && (*p | 0x20) == 'e')
+        {
+            p++;
+            if (p != m_end && (*p == '+' || *p == '-')) p++;
+
+            int exponent = 0;
+            for (; p != m_end && isDigit(*p); p++) exponent++;
+            if (exponent == 0) digits = 0;
+        }
+    }
+
+    // The number has to end there, anything else running on makes all of it invalid
+    const bool valid = digits > 0 && (p == m_end || !(isIdentifierChar(*p) || *p == '.'));
+    while (p != m_end && (isIdentifierChar(*p) || *p == '.')) p++;
+
+    m_cur = p;
+    return Token(valid ? Token::Number : Token::Invalid, Span(start, m_cur));
+}
+
+long long Lexer::offset(const Token &token) const
+{
+    return token.start - m_begin;
+}
+
+};  // namespace LuaParser
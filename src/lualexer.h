@@ -0,0 +1,136 @@
+//  This file is part of LrtEdit.
+//
+// LrtEdit is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// LrtEdit is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LrtEdit.  If not, see <https://www.gnu.org/licenses/>.
+#ifndef LUALEXER_H
+#define LUALEXER_H
+
+#include <QByteArray>
+#include <QString>
+
+namespace LuaParser
+{
+class StructuralIndex;
+
+/// A slice of the source text. Nothing is copied until the slice is converted.
+class Span
+{
+   public:
+    Span() : begin(nullptr), end(nullptr) {}
+    Span(const char *b, const char *e) : begin(b), end(e) {}
+
+    int size() const { return static_cast<int>(end - begin); }
+    bool isEmpty() const { return begin == end; }
+
+    /// Compare against a literal without allocating
+    bool equals(const char *literal) const;
+
+    /// Wraps the slice without copying it, so the source must outlive the result
+    QByteArray toRawByteArray() const { return QByteArray::fromRawData(begin, size()); }
+
+    /// Decode as UTF-8, translating CRLF line endings to LF
+    QString toString() const;
+
+    /// Decode the contents of a quoted string, translating any backslash escapes
+    QString unescaped() const;
+
+    const char *begin;
+    const char *end;
+};
+
+
+class Token
+{
+   public:
+    enum Type
+    {
+        EndOfInput,
+        Identifier,
+        Number,
+        String,  // text excludes the quotes or long brackets
+        OpenBrace,
+        CloseBrace,
+        OpenBracket,
+        CloseBracket,
+        Equals,
+        Comma,  // ',' or ';'
+        Invalid
+    };
+
+    Token() : type(EndOfInput), start(nullptr), escaped(false) {}
+    Token(Type t, const Span &s) : type(t), text(s), start(s.begin), escaped(false) {}
+
+    /// The value of a String token
+    QString stringValue() const { return escaped ? text.unescaped() : text.toString(); }
+
+    Type type;
+    Span text;
+    const char *start;  ///< Where the token begins, including any quotes
+    bool escaped;       ///< A quoted string containing backslash escapes
+};
+
+
+/// Splits a contiguous range of lua source into tokens, in a single pass with no copying.
+/// Handles "--" and "--[[ ]]" comments, '' and "" strings with escapes, [[long strings]],
+/// decimal and hex numbers, '[' ']' for [key]= and ';' as a separator.
+/// The range is not copied, so it must stay valid while the lexer and its tokens are in use.
+class Lexer
+{
+   public:
+    Lexer(const char *begin, const char *end);
+
+    /// Consume and return the next token
+    Token next();
+
+    /// Return the next token without consuming it
+    const Token &peek();
+
+    /// Byte offset of the next unconsumed character, for error reporting
+    long long offset() const;
+
+    /// Byte offset of the start of a token from this lexer, for error reporting
+    long long offset(const Token &token) const;
+
+    /// Continue lexing from p, which must be within the range
+    void seek(const char *p);
+
+    /// An index of the same range, which lets whole tables be skipped without lexing them (may be nullptr)
+    void setStructure(const StructuralIndex *structure) { m_structure = structure; }
+    const StructuralIndex *structure() const { return m_structure; }
+
+   private:
+    Token scan();
+    Token quotedString(const char *start, char quote);
+    Token longString(const char *start, int level);
+    Token number(const char *start);
+
+    const char *m_begin;
+    const char *m_cur;
+    const char *m_end;
+
+    Token m_peeked;
+    bool m_hasPeeked;
+
+    const StructuralIndex *m_structure;
+};
+
+
+/// If p starts a long bracket ("[[", "[=[", "[==[" and so on) return its level (the number of '='), otherwise -1
+int longBracketLevel(const char *p, const char *end);
+
+/// Find the "]]" of the given level that closes a long bracket, searching from p. Returns nullptr if there is none.
+const char *findLongBracketClose(const char *p, const char *end, int level);
+
+};  // namespace LuaParser
+
+#endif // LUALEXER_H
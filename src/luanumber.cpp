@@ -0,0 +1,79 @@
+//  This file is part of LrtEdit.
+//
+// LrtEdit is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// LrtEdit is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LrtEdit.  If not, see <https://www.gnu.org/licenses/>.
+#include "luanumber.h"
+
+#include <QString>
+#include <QVariant>
+
+#include <charconv>
+#include <cstring>
+
+namespace LuaParser
+{
+namespace
+{
+// So a Number works wherever a double from the parser used to be, e.g. toDouble() and value<int>()
+bool registerNumber()
+{
+    QMetaType::registerConverter<Number, double>(&Number::value);
+    QMetaType::registerConverter<Number, int>([](const Number &n) { return qRound(n.value()); });
+    QMetaType::registerConverter<Number, QString>([](const Number &n) { return QString::fromLatin1(n.lexeme()); });
+    QMetaType::registerEqualsComparator<Number>();
+    return true;
+}
+}  // namespace
+
+
+// Floating point std::to_chars and std::from_chars are missing from some standard libraries
+#if defined(__cpp_lib_to_chars) && __cpp_lib_to_chars >= 201611L
+
+int formatDouble(double value, char (&buffer)[formatDoubleSize])
+{
+    const auto result = std::to_chars(buffer, buffer + formatDoubleSize, value, std::chars_format::general, 15);
+    return static_cast<int>(result.ptr - buffer);
+}
+
+bool parseDouble(const char *begin, const char *end, double &value)
+{
+    const auto result = std::from_chars(begin, end, value);
+    return result.ec == std::errc() && result.ptr == end;
+}
+
+#else
+
+int formatDouble(double value, char (&buffer)[formatDoubleSize])
+{
+    const QByteArray text = QByteArray::number(value, 'g', 15);
+    memcpy(buffer, text.constData(), static_cast<size_t>(text.size()));
+    return text.size();
+}
+
+bool parseDouble(const char *begin, const char *end, double &value)
+{
+    bool okay;
+    value = QByteArray::fromRawData(begin, static_cast<int>(end - begin)).toDouble(&okay);
+    return okay;
+}
+
+#endif
+
+
+Number::Number(double value, const QByteArray &lexeme) : m_value(value), m_lexeme(lexeme)
+{
+    static const bool registered = registerNumber();
+    Q_UNUSED(registered);
+}
+
+};  // namespace LuaParser
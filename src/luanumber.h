@@ -0,0 +1,59 @@
+//  This file is part of LrtEdit.
+//
+// LrtEdit is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// LrtEdit is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LrtEdit.  If not, see <https://www.gnu.org/licenses/>.
+#ifndef LUANUMBER_H
+#define LUANUMBER_H
+
+#include <QByteArray>
+#include <QMetaType>
+
+namespace LuaParser
+{
+/// Big enough for any double written by formatDouble()
+const int formatDoubleSize = 32;
+
+/// Write a double as the generator does (15 significant digits, as printf's "%.15g"), without allocating.
+/// @return The number of characters written to buffer, which is not null-terminated
+int formatDouble(double value, char (&buffer)[formatDoubleSize]);
+
+/// Parse the whole of [begin, end) as a double. Returns false if it is not a number.
+bool parseDouble(const char *begin, const char *end, double &value);
+
+
+/// A number which keeps the text it was read from, so it can be written back byte-for-byte.
+/// Only used when writing the value would not give back the original text (e.g. "1.50" or "007"),
+/// everything else is stored as a plain int or double.
+class Number
+{
+   public:
+    Number() : m_value(0) {}
+    Number(double value, const QByteArray &lexeme);
+
+    double value() const { return m_value; }
+    const QByteArray &lexeme() const { return m_lexeme; }
+
+    /// Numbers are equal if they have the same value, however they were written
+    bool operator==(const Number &other) const { return m_value == other.m_value; }
+    bool operator!=(const Number &other) const { return m_value != other.m_value; }
+
+   private:
+    double m_value;
+    QByteArray m_lexeme;
+};
+
+};  // namespace LuaParser
+
+Q_DECLARE_METATYPE(LuaParser::Number);
+
+#endif // LUANUMBER_H
@@ -13,17 +13,22 @@
 // You should have received a copy of the GNU General Public License
 // along with LrtEdit.  If not, see <https://www.gnu.org/licenses/>.
 #include "luaparser.h"
+#include "luanumber.h"
+#include "luascanner.h"
 
-#include <QBuffer>
 #include <QDebug>
 #include <QException>
 #include <QFile>
+#include <QThreadPool>
+#include <QtConcurrent>
+
+#include <charconv>
+#include <cstring>
 
 namespace LuaParser
 {
 // A couple of functions are inter-related so need declarations
-Table readTable(QIODevice *device);
-NamedVariant readVariable(QIODevice *device);
+void readTable(Lexer &lexer, EventHandler &handler);
 
 // Implement the ParserError execption
 ParseError::ParseError(const QString &info, long long where) : m_info(info), m_where(where) {}
@@ -31,335 +36,501 @@ const QString ParseError::info() const { return m_info; }
 long long ParseError::where() const { return m_where; }
 
 
-NamedVariant readLuaStruct(const QString &path)
+NamedVariant readLuaStruct(const QString &path, ReadMode mode)
 {
+    // NB: Not opened in Text mode, the lexer copes with CRLF line endings itself
     QFile f(path);
-    if (f.open(QIODevice::ReadOnly | QIODevice::Text))
-    {
-        QString s = f.readAll();
-        qDebug() << "Read" << s.size() << "bytes from" << path;
-        return parseLuaStruct(s);
-    }
-    else
+    if (!f.open(QIODevice::ReadOnly))
     {
         qCritical() << "Error opening file for reading:" << path;
+        return NamedVariant();
     }
 
-    return NamedVariant();
-}
-
+    const qint64 size = f.size();
+    qDebug() << "Read" << size << "bytes from" << path;
 
-// Peeks at the next character
-char peekChar(QIODevice *device)
-{
-    Q_ASSERT(device != nullptr);
-    Q_ASSERT(!device->atEnd());
+    if (mode == ReadMode::Mapped && size > 0)
+    {
+        // Parse straight from the page cache, the mapping is released when the file is closed
+        const uchar *data = f.map(0, size);
+        if (data != nullptr)
+        {
+            const char *begin = reinterpret_cast<const char *>(data);
+            return parseLuaStruct(begin, begin + size);
+        }
 
-    char c = 0;
-    device->peek(&c, 1);
+        qWarning() << "Unable to map" << path << "so reading it instead";
+    }
 
-    return c;
+    const QByteArray ba = f.readAll();
+    return parseLuaStruct(ba.constData(), ba.constData() + ba.size());
 }
 
 
-// Gets the next character
-char nextChar(QIODevice *device)
+// Throw a ParseError, logging where it happened
+void parseError(const QString &message, long long where)
 {
-    Q_ASSERT(device != nullptr);
-    Q_ASSERT(!device->atEnd());
-
-    char c = 0;
-    device->getChar(&c);
-
-    return c;
+    qCritical() << message << "at" << where;
+    throw ParseError(message, where);
 }
 
+void parseError(const QString &message, const Lexer &lexer) { parseError(message, lexer.offset()); }
 
-void ignoreWhitespace(QIODevice *device)
+
+Value numberValue(const Span &text)
 {
-    Q_ASSERT(device != nullptr);
+    // Hex is always kept as it was written
+    const char *digits = text.begin + (text.begin[0] == '-' ? 1 : 0);
+    if (text.end - digits > 2 && digits[0] == '0' && (digits[1] | 0x20) == 'x')
+    {
+        long long hex;
+        const auto result = std::from_chars(digits + 2, text.end, hex, 16);
+        if (result.ec != std::errc() || result.ptr != text.end) return Value();
 
-    char c;
-    while (!device->atEnd())
+        const double value = static_cast<double>(digits == text.begin ? hex : -hex);
+        return Value(Number(value, QByteArray(text.begin, text.size())));
+    }
+
+    // Straight from the source bytes, nothing is copied unless the text has to be kept
+    int i;
+    const auto asInt = std::from_chars(text.begin, text.end, i);
+    if (asInt.ec == std::errc() && asInt.ptr == text.end)
     {
-        device->getChar(&c);
-        if (!isspace(c))
-        {
-            device->ungetChar(c);
-            return;
-        }
+        // Leading zeros (or "-0") would be lost if stored as an int
+        const bool canonical = text.begin[0] != '0' || text.size() == 1;
+        if (canonical && !(text.begin[0] == '-' && text.begin[1] == '0')) return Value(i);
     }
+
+    double d;
+    if (!parseDouble(text.begin, text.end, d)) return Value();
+
+    // Keep the original text only if it would not be written back the same
+    char formatted[formatDoubleSize];
+    const int length = formatDouble(d, formatted);
+    if (length == text.size() && memcmp(formatted, text.begin, static_cast<size_t>(length)) == 0) return Value(d);
+
+    return Value(Number(d, QByteArray(text.begin, text.size())));
 }
 
 
-void expectLiteral(QIODevice *device, const QString &literal)
+Value stringValue(const Span &text, bool zstr, bool escaped)
 {
-    Q_ASSERT(device != nullptr);
+    if (escaped) return Value::fromString(text.unescaped(), zstr);
 
-    QString token;
+    // Short strings are kept as they are in the source, unless they have line endings to translate
+    if (memchr(text.begin, '\r', static_cast<size_t>(text.size())) != nullptr) return Value::fromString(text.toString(), zstr);
+    return Value::fromUtf8(text.begin, text.end, zstr);
+}
 
-    char c;
-    while (!device->atEnd())
+
+// Read a typed value, starting with a token which has already been consumed
+void readValue(Lexer &lexer, const Token &token, EventHandler &handler)
+{
+    switch (token.type)
     {
-        device->getChar(&c);
-        token.append(c);
-        if (token == literal)
-        {
+        case Token::OpenBrace:
+            readTable(lexer, handler);
             return;
-        }
-        else if (!literal.startsWith(token))
+
+        case Token::Number:
         {
-            qCritical() << "Expected literal '" + literal + "' but found '" + token + "' at" << device->pos();
-            throw ParseError("Expected literal " + literal, device->pos());
+            // The lexer only passes well-formed numbers, but they can still be out of range (e.g. "1e999")
+            const Value value = numberValue(token.text);
+            if (value.isNull()) parseError("Number out of range '" + token.text.toString() + "'", lexer.offset(token));
+            handler.onNumber(token.text, value);
+            return;
         }
+
+        case Token::String:
+            handler.onString(token.text, false, token.escaped);
+            return;
+
+        case Token::Identifier:
+            if (token.text.equals("true"))
+            {
+                handler.onBool(true);
+                return;
+            }
+            else if (token.text.equals("false"))
+            {
+                handler.onBool(false);
+                return;
+            }
+            else if (token.text.equals("ZSTR"))  // Assume this is a ZSTR (whatever one of those is)
+            {
+                const Token s = lexer.next();
+                if (s.type != Token::String) parseError("Expected string after ZSTR", lexer);
+                handler.onString(s.text, true, s.escaped);
+                return;
+            }
+            break;
+
+        case Token::Invalid:
+            parseError("Invalid value '" + token.text.toString() + "'", lexer.offset(token));
+            break;
+
+        default:
+            break;
     }
 
-    qCritical() << "Expected literal '" + literal + "' but ran out of chars with '" + token + "' at" << device->pos();
-    throw ParseError("Expected literal but ran out of input with" + token);
+    parseError("Unsupported variable type", lexer);
 }
 
-
-QString readIdentifier(QIODevice *device)
+/// Skip over a table without reading its contents, returning its text including the braces.
+/// This only needs to match braces, as the lexer (or structural index) takes care of anything quoted or commented.
+Span skipTable(Lexer &lexer, const Token &open)
 {
-    Q_ASSERT(device != nullptr);
+    if (lexer.structure() != nullptr)
+    {
+        const char *close = lexer.structure()->matchingBrace(open.text.begin);
+        if (close == nullptr) parseError("Expected literal '}'", lexer);
 
-    QString identifier;
+        lexer.seek(close + 1);
+        return Span(open.text.begin, close + 1);
+    }
 
-    char c;
-    while (!device->atEnd())
+    int depth = 1;
+    for (;;)
     {
-        device->getChar(&c);
-        if (isalnum(c) || c == '_')
+        const Token token = lexer.next();
+        if (token.type == Token::OpenBrace)
         {
-            identifier.append(c);
+            depth++;
         }
-        else
+        else if (token.type == Token::CloseBrace)
         {
-            device->ungetChar(c);
-            break;
+            if (--depth == 0) return Span(open.text.begin, token.text.end);
+        }
+        else if (token.type == Token::EndOfInput)
+        {
+            parseError("Expected literal '}'", lexer);
         }
     }
-
-    if (identifier.isEmpty()) qWarning() << "Expected identifier but found nothing at" << device->pos();
-
-    return identifier;
 }
 
-
-// Read a quoted string.
-// NB: No escaping is currently implemented (e.g. '\"')
-QString readString(QIODevice *device)
+/// Read a "[key] = value" table entry, the opening bracket having already been consumed.
+/// Tables only have string keys and a list, so numeric keys have to continue the list.
+void readBracketEntry(Lexer &lexer, EventHandler &handler, int &items)
 {
-    Q_ASSERT(device != nullptr);
-
-    expectLiteral(device, "\"");
-
-    QString value;
+    const Token key = lexer.next();
+    if (lexer.next().type != Token::CloseBracket) parseError("Expected literal ']'", lexer);
+    if (lexer.next().type != Token::Equals) parseError("Expected literal '='", lexer);
 
-    while (!device->atEnd() && peekChar(device) != '"')
+    if (key.type == Token::String)
     {
-        value.append(nextChar(device));
+        handler.onKey(key.text, key.escaped);
+        readValue(lexer, lexer.next(), handler);
     }
+    else if (key.type == Token::Number)
+    {
+        int index = 0;
+        const auto result = std::from_chars(key.text.begin, key.text.end, index);
+        if (result.ec != std::errc() || result.ptr != key.text.end || index != items + 1)
+            parseError("Only the next list index is supported as a numeric key", lexer);
 
-    expectLiteral(device, "\"");
-
-    return value;
+        readValue(lexer, lexer.next(), handler);
+        items++;
+    }
+    else
+    {
+        parseError("Expected a string or number key", lexer);
+    }
 }
 
-
-QVariant readNumber(QIODevice *device)
+/// Read a lua table, the opening brace having already been consumed.
+/// Table syntax described in https://www.lua.org/pil/3.6.html
+void readTable(Lexer &lexer, EventHandler &handler)
 {
-    Q_ASSERT(device != nullptr);
+    handler.onTableBegin();
 
-    QString number;
+    // Number of list items so far, for "[n] =" entries
+    int items = 0;
 
-    char c;
-    while (!device->atEnd())
+    // Will either be an identifier, a [key], a list item or the end of the table
+    Token token = lexer.next();
+    while (token.type != Token::CloseBrace)
     {
-        c = peekChar(device);
-        if (!isdigit(c) && c != '.' && c != '-') break;
+        if (token.type == Token::Identifier && lexer.peek().type == Token::Equals)
+        {
+            lexer.next();
+            handler.onKey(token.text, false);
+            readValue(lexer, lexer.next(), handler);
+        }
+        else if (token.type == Token::OpenBracket)
+        {
+            readBracketEntry(lexer, handler, items);
+        }
+        else if (token.type == Token::OpenBrace && handler.wantsRawTable())
+        {
+            handler.onRawTable(skipTable(lexer, token));
+            items++;
+        }
+        else
+        {
+            // Assume an unamed list item
+            readValue(lexer, token, handler);
+            items++;
+        }
 
-        number.append(nextChar(device));
+        token = lexer.next();
+        if (token.type == Token::Comma)
+        {
+            // NB: A comma is not strictly required at the end of list, but usually there on the Adobe files
+            // NB: A semi-colon is also fine here, according to the Lua spec (instead of a comma)
+            token = lexer.next();
+        }
+        else if (token.type != Token::CloseBrace)
+        {
+            parseError("Expected ',' or '}'", lexer);
+        }
     }
 
-    if (number.isEmpty()) qWarning() << "Expected number but found nothing at" << device->pos();
-
-    bool okay;
+    handler.onTableEnd();
+}
 
-    const int i = number.toInt(&okay);
-    if (okay) return QVariant::fromValue(i);
+void readVariable(Lexer &lexer, EventHandler &handler)
+{
+    const Token identifier = lexer.next();
+    if (identifier.type != Token::Identifier) parseError("Expected identifier", lexer);
 
-    const double d = number.toDouble(&okay);
-    if (okay) return QVariant::fromValue(d);
+    if (lexer.next().type != Token::Equals) parseError("Expected literal '='", lexer);
 
-    return QVariant();
+    handler.onKey(identifier.text, false);
+    readValue(lexer, lexer.next(), handler);
 }
 
 
-QVariant readBool(QIODevice *device)
+/// Builds the Table tree from parser events
+class TableBuilder : public EventHandler
 {
-    Q_ASSERT(device != nullptr);
-    const QString s = readIdentifier(device);
-    if (s == "true")
-    {
-        return QVariant::fromValue(true);
-    }
-    else if (s == "false")
-    {
-        return QVariant::fromValue(false);
-    }
-    else
-    {
-        qCritical() << "Expected boolean but found" << s;
-        throw ParseError(s + " is not a boolean value", device->pos());
-    }
-}
+   public:
+    /// @param source Start of the text being parsed, or nullptr to build everything on this thread
+    explicit TableBuilder(const char *source = nullptr) : m_source(source), m_hasKey(false) {}
 
+    const NamedVariant &result() const { return m_result; }
 
-// Read a typed value
-QVariant readValue(QIODevice *device)
-{
-    QVariant value;
-    ignoreWhitespace(device);
-    const char c = peekChar(device);
-    if (c == '{')
-    {
-        const Table table = readTable(device);
-        value = QVariant::fromValue(table);
-    }
-    //    else if (isalnum(nextChar(device)))
-    else if (isdigit(c) || c == '-')
-    {
-        // read a number
-        value = readNumber(device);
-    }
-    else if (c == '"')
+    /// The top-level value, as it was stored
+    const Value &value() const { return m_value; }
+
+    void onTableBegin() override
     {
-        value = readString(device);
+        // Remember where the table is going, as the key is overwritten by its contents
+        m_stack.append(Frame{m_key, m_hasKey, m_items.size(), m_named.size(), QVector<int>(), QVector<Span>()});
+        m_hasKey = false;
     }
-    else if (c == 'Z')  // Assume this is a ZSTR (whatever one of those is)
+
+    void onKey(const Span &name, bool escaped) override
     {
-        expectLiteral(device, "ZSTR");
-        ignoreWhitespace(device);
-        value = "ZSTR:" + readString(device);
+        // Interned straight from the source, keys are only decoded the first time they are seen
+        m_key = escaped ? Atom(name.unescaped()) : Atom::fromUtf8(name.begin, name.end);
+        m_hasKey = true;
     }
-    else if (c == 't' || c == 'f')  // Assume this is a bool?
+
+    void onNumber(const Span &, const Value &value) override { store(Value(value)); }
+
+    void onString(const Span &text, bool zstr, bool escaped) override { store(stringValue(text, zstr, escaped)); }
+
+    void onBool(bool value) override { store(Value(value)); }
+
+    void onTableEnd() override
     {
-        value = readBool(device);
+        Frame frame = m_stack.takeLast();
+        if (!frame.deferred.isEmpty()) buildDeferred(frame);
+
+        // Its contents are all known by now, so the table is allocated once at its final size
+        Table table;
+        table.reserve(m_items.size() - frame.items, m_named.size() - frame.named);
+        for (int i = frame.items; i < m_items.size(); i++) table.append(std::move(m_items[i]));
+        for (int i = frame.named; i < m_named.size(); i++) table[m_named[i].first] = std::move(m_named[i].second);
+        m_items.resize(frame.items);
+        m_named.resize(frame.named);
+
+        m_key = frame.key;
+        m_hasKey = frame.hasKey;
+        store(Value(table));
     }
-    else
+
+    /// List items of the top-level table and its children are independent of each other
+    /// (e.g. the pages of a template), so are handed out to other threads to build
+    bool wantsRawTable() override { return m_source != nullptr && m_stack.size() <= 2; }
+
+    void onRawTable(const Span &text) override
     {
-        qCritical() << "Unsupported variable type at" << device->pos();
-        throw ParseError("Unsupported variable type", device->pos());
+        // Leave a gap to be filled in once the whole list has been found
+        Frame &frame = m_stack.last();
+        frame.positions.append(m_items.size());
+        frame.deferred.append(text);
+        m_items.append(Value());
     }
 
-    return value;
-}
+   private:
+    struct Frame
+    {
+        Atom key;
+        bool hasKey;
 
-/// Read a lua table from a device.
-/// Table syntax described in https://www.lua.org/pil/3.6.html
-Table readTable(QIODevice *device)
-{
-    Q_ASSERT(device != nullptr);
+        // Where its list items and named entries start in m_items and m_named
+        int items;
+        int named;
 
-    Table table;
+        // List items to be built on other threads, and where they go in m_items
+        QVector<int> positions;
+        QVector<Span> deferred;
+    };
 
-    ignoreWhitespace(device);
+    struct Deferred
+    {
+        Table table;
+        bool okay = false;
+        QString info;
+        long long where = 0;
+    };
 
-    expectLiteral(device, "{");
+    static Deferred buildTable(const Span &text)
+    {
+        Deferred d;
+        TableBuilder builder;
+        Lexer lexer(text.begin, text.end);
+        try
+        {
+            readValue(lexer, lexer.next(), builder);
+            d.table = builder.result().value().value<Table>();
+            d.okay = true;
+        }
+        catch (const ParseError &e)
+        {
+            d.info = e.info();
+            d.where = e.where();
+        }
 
-    ignoreWhitespace(device);
+        return d;
+    }
 
-    // Will either be an identifier or the end of the table
-    while (peekChar(device) != '}')
+    void buildDeferred(Frame &frame)
     {
-        const char c = peekChar(device);
+        const QVector<Deferred> built = QtConcurrent::blockingMapped(frame.deferred, buildTable);
 
-        if (isalnum(c))
-        {
-            // Either found bool (true/false) or an identifier.
-            // Not needing to support list of bools here, so just assume a variable
-            const NamedVariant nv = readVariable(device);
-            table[nv.name()] = nv.value();
-        }
-        else
+        for (int i = 0; i < built.size(); i++)
         {
-            // Assume an unamed list item
-            const QVariant item = readValue(device);
-            table.append(item);
+            if (!built[i].okay)
+            {
+                // Report the first problem, relative to the whole text
+                throw ParseError(built[i].info, (frame.deferred[i].begin - m_source) + built[i].where);
+            }
+
+            m_items[frame.positions[i]] = Value(built[i].table);
         }
+    }
 
-        ignoreWhitespace(device);
-        if (peekChar(device) != ',')
+    void store(Value &&value)
+    {
+        if (m_stack.isEmpty())
         {
-            // No trailing comma, so expect the end of the list to be found
-            break;
+            m_value = value;
+            m_result = NamedVariant(m_key.toString(), value.toVariant());
         }
-        expectLiteral(device, ",");
-        // NB: A comma is not strictly required at the end of list, but usually there on the Adobe files
-        // NB: A semi-colon is also fine here, according to the Lua spec (instead of a comma)
+        else if (m_hasKey)
+            m_named.append(qMakePair(m_key, std::move(value)));
+        else
+            m_items.append(std::move(value));
 
-        ignoreWhitespace(device);
+        m_hasKey = false;
     }
 
-    ignoreWhitespace(device);
-    expectLiteral(device, "}");
+    const char *m_source;
+    QVector<Frame> m_stack;
 
-    return table;
-}
+    // Contents of the tables being read, innermost last, until each table is complete
+    QVector<Value> m_items;
+    QVector<QPair<Atom, Value>> m_named;
 
-NamedVariant readVariable(QIODevice *device)
-{
-    Q_ASSERT(device != nullptr);
+    Atom m_key;
+    bool m_hasKey;
+    NamedVariant m_result;
+    Value m_value;
+};
 
-    ignoreWhitespace(device);
 
-    const QString identifier = readIdentifier(device);
+EventHandler::~EventHandler() {}
 
-    ignoreWhitespace(device);
-    expectLiteral(device, "=");
+bool EventHandler::wantsRawTable() { return false; }
 
-    const QVariant value = readValue(device);
-
-    // qDebug() << "Read variable:" << identifier << "=" << value;
-    return NamedVariant(identifier, value);
-}
+void EventHandler::onRawTable(const Span &) {}
 
 
-/// Remove whole line comments
-QString uncommented(const QString &s)
+// Parse with a lexer which may have a structural index attached
+bool parseLuaEvents(Lexer &lexer, const char *begin, const char *end, EventHandler &handler)
 {
-    QStringList lines = s.split('\n');
-    int l = 0;
-    while (l < lines.size())
+    try
     {
-        if (lines[l].trimmed().startsWith("--"))
-            lines.removeAt(l);
-        else
-            l++;
+        readVariable(lexer, handler);
+    }
+    catch (const ParseError &e)
+    {
+        const QByteArray context = QByteArray::fromRawData(begin + e.where(), static_cast<int>(qMin(5LL, (end - begin) - e.where())));
+        qCritical() << "There was a problem parsing" << e.info() << "at" << e.where() << ":" << context;
+        return false;
     }
-    return lines.join('\n');
-}
 
+    return true;
+}
 
-NamedVariant parseLuaStruct(const QString &s)
+bool parseLuaEvents(const char *begin, const char *end, EventHandler &handler)
 {
-    NamedVariant nv;
+    Lexer lexer(begin, end);
+    return parseLuaEvents(lexer, begin, end, handler);
+}
 
-    QByteArray ba(uncommented(s).toUtf8());
-    QBuffer buffer(&ba);
-    buffer.open(QIODevice::ReadOnly);
+
+Value parseLuaValue(const char *begin, const char *end)
+{
+    TableBuilder builder;
+    Lexer lexer(begin, end);
     try
     {
-        nv = readVariable(&buffer);
+        readValue(lexer, lexer.next(), builder);
+        if (lexer.next().type != Token::EndOfInput) parseError("Expected the end of the value", lexer);
     }
     catch (const ParseError &e)
     {
-        qCritical() << "There was a problem parsing" << e.info() << "at" << e.where() << ":" << s.mid(e.where(), 5);
-        //        throw e;
+        qCritical() << "There was a problem parsing" << e.info() << "at" << e.where();
+        return Value();
+    }
+
+    return builder.value();
+}
+
+
+NamedVariant parseLuaStruct(const QString &s)
+{
+    const QByteArray ba(s.toUtf8());
+    return parseLuaStruct(ba.constData(), ba.constData() + ba.size());
+}
+
+
+NamedVariant parseLuaStruct(const char *begin, const char *end, ThreadMode threads)
+{
+    // Below this it is quicker to do everything on one thread
+    const long long parallelThreshold = 256 * 1024;
+
+    bool parallel = threads == ThreadMode::Parallel;
+    if (threads == ThreadMode::Automatic)
+        parallel = end - begin >= parallelThreshold && QThreadPool::globalInstance()->maxThreadCount() > 1;
+
+    TableBuilder builder(parallel ? begin : nullptr);
+    Lexer lexer(begin, end);
+
+    // The items handed to other threads are found with the index, rather than lexing them twice
+    StructuralIndex structure;
+    if (parallel)
+    {
+        structure = StructuralIndex(begin, end);
+        lexer.setStructure(&structure);
     }
 
-    return nv;
+    if (!parseLuaEvents(lexer, begin, end, builder)) return NamedVariant();
+
+    return builder.result();
 }
 
 }  // end of namespace LuaParser
@@ -15,6 +15,7 @@
 #ifndef LUAPARSER_H
 #define LUAPARSER_H
 
+#include "lualexer.h"
 #include "luatable.h"
 
 #include <QException>
@@ -49,12 +50,73 @@ class NamedVariant : public QPair<QString, QVariant>
 };
 
 
+/// Receives the contents of a lua structure as it is parsed, without a Table being built.
+/// Named entries are preceded by onKey(), list items are not. The top-level variable
+/// arrives as an onKey() for its name followed by its value. Strings, and keys written as
+/// ["strings"], are passed as they appear in the source, with escaped set if they need
+/// Span::unescaped() to decode them.
+/// Numbers come with their value, as numberValue() converts them.
+/// The spans point into the parser's input and are only valid during the call.
+class EventHandler
+{
+   public:
+    virtual ~EventHandler();
+
+    virtual void onTableBegin() = 0;
+    virtual void onKey(const Span &name, bool escaped) = 0;
+    virtual void onNumber(const Span &text, const Value &value) = 0;
+    virtual void onString(const Span &text, bool zstr, bool escaped) = 0;
+    virtual void onBool(bool value) = 0;
+    virtual void onTableEnd() = 0;
+
+    /// Asked when a list item turns out to be a table. Returning true means the parser skips
+    /// over it and passes its text to onRawTable(), rather than sending events for its contents.
+    virtual bool wantsRawTable();
+    virtual void onRawTable(const Span &text);
+};
+
+
+/// How readLuaStruct gets at the contents of a file
+enum class ReadMode
+{
+    Mapped,   ///< Parse directly from a memory mapping of the file (falls back to Buffered if mapping fails)
+    Buffered  ///< Read the whole file into memory first
+};
+
+/// Whether parseLuaStruct can share the work out between threads
+enum class ThreadMode
+{
+    Automatic,  ///< Use other threads for large inputs, when there are cores to spare
+    Serial,
+    Parallel
+};
+
 /// Utility function to read a structure from a file
-NamedVariant readLuaStruct(const QString &path);
+NamedVariant readLuaStruct(const QString &path, ReadMode mode = ReadMode::Mapped);
 
 /// Parses a lua-style structure, as used for storing data in Adobe Lightroom templates
 NamedVariant parseLuaStruct(const QString &s);
 
+/// Parses a lua-style structure from UTF-8 text, without taking a copy of it.
+/// In parallel, the list items of the top-level table and its children (e.g. the pages
+/// of a template) are each built on a worker thread.
+NamedVariant parseLuaStruct(const char *begin, const char *end, ThreadMode threads = ThreadMode::Automatic);
+
+/// Parses a lua-style structure, passing its contents to handler rather than building a Table.
+/// @return false if there was a parse error, in which case handler has seen part of the input
+bool parseLuaEvents(const char *begin, const char *end, EventHandler &handler);
+
+/// Parses a single lua value, such as a table cut out of the middle of a structure.
+/// @return A null Value if [begin, end) is not exactly one value
+Value parseLuaValue(const char *begin, const char *end);
+
+/// Convert a number token to an int or double Value, or a Number if its text
+/// would not otherwise be written back unchanged. Null if it is not a number lua can hold.
+Value numberValue(const Span &text);
+
+/// Convert a string token (the text between its quotes) to a Value, decoded as Span::toString() would
+Value stringValue(const Span &text, bool zstr, bool escaped);
+
 };  // namespace LuaParser
 
 #endif // LUAPARSER_H
@@ -0,0 +1,49 @@
+//  This file is part of LrtEdit.
+//
+// LrtEdit is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// LrtEdit is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LrtEdit.  If not, see <https://www.gnu.org/licenses/>.
+#include "luapool.h"
+
+namespace LuaParser
+{
+Table TablePool::intern(const Table &table)
+{
+    // The tables inside come first, so that comparing this one with those in the pool only
+    // has to compare pointers to them
+    Table pooled = table;
+    table.forEach([&](const Table::Entry &entry) {
+        if (entry.kind != Value::Kind::Table) return;
+
+        const Table *child = entry.value.table();
+        const Table shared = intern(*child);
+        if (shared.isSharedWith(*child)) return;
+        if (entry.isIndex())
+            pooled[entry.index] = shared;
+        else
+            pooled[*entry.key] = shared;
+    });
+
+    const auto it = m_tables.constFind(pooled);
+    if (it != m_tables.constEnd()) return *it;
+
+    m_tables.insert(pooled);
+    return pooled;
+}
+
+NamedVariant TablePool::intern(const NamedVariant &nv)
+{
+    if (!nv.value().canConvert<Table>()) return nv;
+    return NamedVariant(nv.name(), QVariant::fromValue(intern(nv.value().value<Table>())));
+}
+
+};  // namespace LuaParser
@@ -0,0 +1,52 @@
+//  This file is part of LrtEdit.
+//
+// LrtEdit is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// LrtEdit is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LrtEdit.  If not, see <https://www.gnu.org/licenses/>.
+#ifndef LUAPOOL_H
+#define LUAPOOL_H
+
+#include "luaparser.h"
+
+#include <QSet>
+
+namespace LuaParser
+{
+/// Shares equal tables, so that the many copies of the same hints, styles and text attributes
+/// in a template (and across templates) are kept once.
+///
+/// Tables are found by their content hash. Once interned, equal tables share their contents, so
+/// comparing them is a pointer compare. Editing one later detaches it from the pool as usual,
+/// so the pooled tables never change. Not thread safe.
+class TablePool
+{
+   public:
+    /// The pooled table equal to table, adding one (with the tables inside it pooled) if there
+    /// is not one already
+    Table intern(const Table &table);
+
+    /// As above, for the table in a parsed structure
+    NamedVariant intern(const NamedVariant &nv);
+
+    /// Number of distinct tables in the pool
+    int size() const { return m_tables.size(); }
+
+    /// Forget the pooled tables. Those in use elsewhere are kept, but no longer shared with new ones.
+    void clear() { m_tables.clear(); }
+
+   private:
+    QSet<Table> m_tables;
+};
+
+};  // namespace LuaParser
+
+#endif // LUAPOOL_H
@@ -0,0 +1,207 @@
+//  This file is part of LrtEdit.
+//
+// LrtEdit is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// LrtEdit is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LrtEdit.  If not, see <https://www.gnu.org/licenses/>.
+#include "luaquery.h"
+
+#include <QDebug>
+#include <QStringList>
+
+namespace LuaParser
+{
+Query::Query(const QString &pattern)
+{
+    // Split at each '/' which is not in a condition
+    QStringList parts;
+    QString current;
+    bool inCondition = false, inString = false;
+    for (const QChar c : pattern)
+    {
+        if (c == '"') inString = !inString;
+        if (!inString && c == '[') inCondition = true;
+        if (!inString && c == ']') inCondition = false;
+
+        if (c == '/' && !inCondition && !inString)
+        {
+            parts.append(current);
+            current.clear();
+        }
+        else
+        {
+            current += c;
+        }
+    }
+    if (!pattern.isEmpty()) parts.append(current);
+
+    for (const QString &part : parts)
+    {
+        Step step;
+        const int bracket = part.indexOf('[');
+        const QString name = bracket >= 0 ? part.left(bracket) : part;
+        step.wildcard = name == "*";
+        if (!step.wildcard)
+        {
+            if (!name.isEmpty() && name[0].isDigit())
+                step.segment = name.toInt();
+            else
+                step.segment = Atom(name);
+        }
+
+        // Each condition is [path=value], with no '=' in the path, and ']' only in a string value
+        for (int at = bracket; at >= 0 && at < part.size();)
+        {
+            int close = -1;
+            inString = false;
+            for (int i = at + 1; i < part.size() && close < 0; i++)
+            {
+                if (part[i] == '"') inString = !inString;
+                if (part[i] == ']' && !inString) close = i;
+            }
+            const int equals = part.indexOf('=', at);
+            if (part[at] != '[' || close < 0 || equals < 0 || equals > close)
+            {
+                qCritical() << "Invalid condition in query '" + pattern + "'";
+                throw QException();
+            }
+
+            QString text = part.mid(equals + 1, close - equals - 1);
+            if (text.startsWith('=')) text.remove(0, 1);
+            step.conditions.append({Table::Path(part.mid(at + 1, equals - at - 1).trimmed()), conditionValue(text.trimmed())});
+            at = close + 1;
+        }
+        m_steps.append(step);
+    }
+}
+
+Value Query::conditionValue(const QString &text)
+{
+    if (text.size() >= 2 && text.at(0) == '"' && text.at(text.size() - 1) == '"') return Value(text.mid(1, text.size() - 2));
+    if (text == "true") return Value(true);
+    if (text == "false") return Value(false);
+
+    bool ok = false;
+    const int i = text.toInt(&ok);
+    if (ok) return Value(i);
+    const double d = text.toDouble(&ok);
+    if (ok) return Value(d);
+
+    qCritical() << "Invalid value '" + text + "' in query condition";
+    throw QException();
+}
+
+bool Query::Step::accepts(const Value &value) const
+{
+    if (conditions.isEmpty()) return true;
+
+    const Table *table = value.table();
+    if (table == nullptr) return false;
+
+    for (const Condition &condition : conditions)
+    {
+        const Value *v = table->find(condition.path);
+        if (v == nullptr || *v != condition.value) return false;
+    }
+    return true;
+}
+
+Table::Path Query::Match::path() const
+{
+    Table::Path path;
+    int wildcard = 0;
+    for (const Step &step : m_query->m_steps)
+    {
+        if (step.wildcard)
+            path << m_indices.at(wildcard++);
+        else
+            path << step.segment;
+    }
+    return path;
+}
+
+int Query::Matches::count() const
+{
+    int n = 0;
+    for (auto it = begin(); it != end(); ++it) n++;
+    return n;
+}
+
+Query::Matches::const_iterator::const_iterator(const Query *query, const Table *table)
+    : m_query(query), m_table(table), m_done(false), m_values(query->m_steps.size()), m_positions(query->m_steps.size())
+{
+    m_match.m_query = query;
+    if (query->isEmpty())
+        m_done = true;
+    else
+        find(0);
+}
+
+Query::Matches::const_iterator &Query::Matches::const_iterator::operator++()
+{
+    if (!m_done) find(m_values.size() - 1);
+    return *this;
+}
+
+void Query::Matches::const_iterator::find(int step)
+{
+    // Depth first: each step moves on to the next value it matches, handing back to the
+    // step before when it runs out
+    const int last = m_values.size() - 1;
+    while (step >= 0)
+    {
+        const Value *value = next(step);
+        if (value == nullptr)
+        {
+            step--;
+            continue;
+        }
+
+        m_values[step] = value;
+        if (step == last)
+        {
+            m_match.m_value = value;
+            m_match.m_indices.clear();
+            for (int i = 0; i <= last; i++)
+            {
+                if (m_query->m_steps.at(i).wildcard) m_match.m_indices.append(m_positions.at(i));
+            }
+            return;
+        }
+        m_positions[++step] = 0;
+    }
+    m_done = true;
+}
+
+const Value *Query::Matches::const_iterator::next(int step)
+{
+    const Table *table = step == 0 ? m_table : m_values.at(step - 1)->table();
+    if (table == nullptr) return nullptr;
+
+    const Step &s = m_query->m_steps.at(step);
+    int &position = m_positions[step];
+    if (s.wildcard)
+    {
+        while (++position <= table->hash())
+        {
+            const Value &value = (*table)[position];
+            if (s.accepts(value)) return &value;
+        }
+        return nullptr;
+    }
+
+    // Anything else only matches once
+    if (position++ > 0) return nullptr;
+    const Value *value = table->find(s.segment);
+    return value != nullptr && s.accepts(*value) ? value : nullptr;
+}
+
+};  // namespace LuaParser
@@ -0,0 +1,132 @@
+//  This file is part of LrtEdit.
+//
+// LrtEdit is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// LrtEdit is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LrtEdit.  If not, see <https://www.gnu.org/licenses/>.
+#ifndef LUAQUERY_H
+#define LUAQUERY_H
+
+#include "luatable.h"
+
+#include <QString>
+#include <QVector>
+
+namespace LuaParser
+{
+/// A path pattern, matching any number of values in a table.
+///
+/// As a Table path, with two additions: a "*" segment matches every list item, and any
+/// segment can be followed by conditions in brackets which what it matches has to meet,
+/// e.g. pages/*/1/children/*[placeholderType="photo"]/transform. A condition is a path
+/// in the matched table, "=" (or "=="), and a string in double quotes, a number, true or false.
+class Query
+{
+   public:
+    class Matches;
+
+    /// Where a query matched
+    class Match
+    {
+       public:
+        /// The value matched, in the table the query was run over
+        const Value &value() const { return *m_value; }
+
+        /// The list item each "*" in the query was at
+        const QVector<int> &indices() const { return m_indices; }
+        int index(int wildcard) const { return m_indices.at(wildcard); }
+
+        /// Where the value is, e.g. for Table::Edits
+        Table::Path path() const;
+
+       private:
+        friend class Matches;
+        const Query *m_query = nullptr;
+        const Value *m_value = nullptr;
+        QVector<int> m_indices;
+    };
+
+    /// The values a query matches, found as they are iterated over. Nothing is copied, so
+    /// the table must not be changed while they are.
+    class Matches
+    {
+       public:
+        class const_iterator
+        {
+           public:
+            const Match &operator*() const { return m_match; }
+            const Match *operator->() const { return &m_match; }
+            const_iterator &operator++();
+            bool operator==(const const_iterator &other) const { return m_done == other.m_done && (m_done || m_positions == other.m_positions); }
+            bool operator!=(const const_iterator &other) const { return !(*this == other); }
+
+           private:
+            friend class Matches;
+            const_iterator(const Query *query, const Table *table);
+            const_iterator() : m_query(nullptr), m_table(nullptr), m_done(true) {}
+
+            void find(int step);
+            const Value *next(int step);
+
+            const Query *m_query;
+            const Table *m_table;
+            bool m_done;
+            QVector<const Value *> m_values;  ///< Matched by each step
+            QVector<int> m_positions;         ///< Of each step, in its table
+            Match m_match;
+        };
+
+        const_iterator begin() const { return const_iterator(m_query, m_table); }
+        const_iterator end() const { return const_iterator(); }
+
+        /// Number of matches, which means finding all of them
+        int count() const;
+
+       private:
+        friend class Query;
+        Matches(const Query *query, const Table *table) : m_query(query), m_table(table) {}
+
+        const Query *m_query;
+        const Table *m_table;
+    };
+
+    Query() {}
+    explicit Query(const QString &pattern);
+
+    bool isEmpty() const { return m_steps.isEmpty(); }
+
+    /// Run over a table, which (like the query) has to outlive the matches
+    Matches matches(const Table &table) const { return Matches(this, &table); }
+
+   private:
+    struct Condition
+    {
+        Table::Path path;
+        Value value;
+    };
+
+    struct Step
+    {
+        bool wildcard = false;
+        Table::Path::Segment segment = 0;
+        QVector<Condition> conditions;
+
+        bool accepts(const Value &value) const;
+    };
+
+    static Value conditionValue(const QString &text);
+
+    QVector<Step> m_steps;
+};
+
+};  // namespace LuaParser
+
+#endif // LUAQUERY_H
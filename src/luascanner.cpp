@@ -0,0 +1,464 @@
+//  This file is part of LrtEdit.
+//
+// LrtEdit is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// LrtEdit is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LrtEdit.  If not, see <https://www.gnu.org/licenses/>.
+#include "luascanner.h"
+#include "lualexer.h"
+
+#include <QtAlgorithms>
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define LRT_SCAN_SSE2
+#include <emmintrin.h>
+#endif
+
+// AVX2 is compiled in regardless of the build flags and only used if the CPU has it
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define LRT_SCAN_AVX2
+#define LRT_TARGET_AVX2 __attribute__((target("avx2")))
+#include <immintrin.h>
+#elif defined(_MSC_VER) && defined(_M_X64)
+#define LRT_SCAN_AVX2
+#define LRT_TARGET_AVX2
+#include <immintrin.h>
+#include <intrin.h>
+#endif
+
+namespace LuaParser
+{
+namespace
+{
+const int blockSize = 64;
+
+/// One bit per byte of a block, for the characters which matter
+struct Masks
+{
+    quint64 structural;  // { } [ ] = , ;
+    quint64 doubleQuote;
+    quint64 singleQuote;
+    quint64 backslash;
+    quint64 openBracket;
+    quint64 closeBracket;
+    quint64 dash;
+    quint64 newline;
+    quint64 space;  // including newlines
+};
+
+
+Masks classifyScalar(const char *p)
+{
+    Masks m = {0, 0, 0, 0, 0, 0, 0, 0, 0};
+    for (int i = 0; i < blockSize; i++)
+    {
+        const quint64 bit = quint64(1) << i;
+        switch (p[i])
+        {
+            case '{':
+            case '}':
+            case '=':
+            case ',':
+            case ';':
+                m.structural |= bit;
+                break;
+            case '[':
+                m.structural |= bit;
+                m.openBracket |= bit;
+                break;
+            case ']':
+                m.structural |= bit;
+                m.closeBracket |= bit;
+                break;
+            case '"':
+                m.doubleQuote |= bit;
+                break;
+            case '\'':
+                m.singleQuote |= bit;
+                break;
+            case '\\':
+                m.backslash |= bit;
+                break;
+            case '-':
+                m.dash |= bit;
+                break;
+            case '\n':
+                m.newline |= bit;
+                m.space |= bit;
+                break;
+            case ' ':
+            case '\t':
+            case '\v':
+            case '\f':
+            case '\r':
+                m.space |= bit;
+                break;
+            default:
+                break;
+        }
+    }
+    return m;
+}
+
+
+#ifdef LRT_SCAN_SSE2
+inline __m128i equal16(__m128i v, char c) { return _mm_cmpeq_epi8(v, _mm_set1_epi8(c)); }
+
+inline quint64 bits16(__m128i v) { return static_cast<quint64>(static_cast<quint32>(_mm_movemask_epi8(v)) & 0xFFFF); }
+
+Masks classifySse2(const char *p)
+{
+    Masks m = {0, 0, 0, 0, 0, 0, 0, 0, 0};
+    for (int k = 0; k < blockSize / 16; k++)
+    {
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 16 * k));
+        const int shift = 16 * k;
+
+        const __m128i openBracket = equal16(v, '[');
+        const __m128i closeBracket = equal16(v, ']');
+        const __m128i structural =
+            _mm_or_si128(_mm_or_si128(_mm_or_si128(equal16(v, '{'), equal16(v, '}')), _mm_or_si128(equal16(v, '='), equal16(v, ','))),
+                         _mm_or_si128(_mm_or_si128(openBracket, closeBracket), equal16(v, ';')));
+
+        // '\t' to '\r' are contiguous, so is a single unsigned range check
+        const __m128i fromTab = _mm_sub_epi8(v, _mm_set1_epi8('\t'));
+        const __m128i controls = _mm_cmpeq_epi8(_mm_min_epu8(fromTab, _mm_set1_epi8('\r' - '\t')), fromTab);
+        const __m128i space = _mm_or_si128(controls, equal16(v, ' '));
+
+        m.structural |= bits16(structural) << shift;
+        m.doubleQuote |= bits16(equal16(v, '"')) << shift;
+        m.singleQuote |= bits16(equal16(v, '\'')) << shift;
+        m.backslash |= bits16(equal16(v, '\\')) << shift;
+        m.openBracket |= bits16(openBracket) << shift;
+        m.closeBracket |= bits16(closeBracket) << shift;
+        m.dash |= bits16(equal16(v, '-')) << shift;
+        m.newline |= bits16(equal16(v, '\n')) << shift;
+        m.space |= bits16(space) << shift;
+    }
+    return m;
+}
+#endif
+
+
+#ifdef LRT_SCAN_AVX2
+LRT_TARGET_AVX2 inline __m256i equal32(__m256i v, char c) { return _mm256_cmpeq_epi8(v, _mm256_set1_epi8(c)); }
+
+LRT_TARGET_AVX2 inline quint64 bits32(__m256i v) { return static_cast<quint64>(static_cast<quint32>(_mm256_movemask_epi8(v))); }
+
+LRT_TARGET_AVX2 Masks classifyAvx2(const char *p)
+{
+    Masks m = {0, 0, 0, 0, 0, 0, 0, 0, 0};
+    for (int k = 0; k < blockSize / 32; k++)
+    {
+        const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + 32 * k));
+        const int shift = 32 * k;
+
+        const __m256i openBracket = equal32(v, '[');
+        const __m256i closeBracket = equal32(v, ']');
+        const __m256i structural = _mm256_or_si256(
+            _mm256_or_si256(_mm256_or_si256(equal32(v, '{'), equal32(v, '}')), _mm256_or_si256(equal32(v, '='), equal32(v, ','))),
+            _mm256_or_si256(_mm256_or_si256(openBracket, closeBracket), equal32(v, ';')));
+
+        const __m256i fromTab = _mm256_sub_epi8(v, _mm256_set1_epi8('\t'));
+        const __m256i controls = _mm256_cmpeq_epi8(_mm256_min_epu8(fromTab, _mm256_set1_epi8('\r' - '\t')), fromTab);
+        const __m256i space = _mm256_or_si256(controls, equal32(v, ' '));
+
+        m.structural |= bits32(structural) << shift;
+        m.doubleQuote |= bits32(equal32(v, '"')) << shift;
+        m.singleQuote |= bits32(equal32(v, '\'')) << shift;
+        m.backslash |= bits32(equal32(v, '\\')) << shift;
+        m.openBracket |= bits32(openBracket) << shift;
+        m.closeBracket |= bits32(closeBracket) << shift;
+        m.dash |= bits32(equal32(v, '-')) << shift;
+        m.newline |= bits32(equal32(v, '\n')) << shift;
+        m.space |= bits32(space) << shift;
+    }
+    return m;
+}
+
+bool cpuHasAvx2()
+{
+#if defined(__GNUC__)
+    return __builtin_cpu_supports("avx2");
+#else
+    int info[4];
+    __cpuid(info, 1);
+    const bool osSavesYmm = (info[2] & (1 << 27)) && (_xgetbv(0) & 6) == 6;
+    __cpuidex(info, 7, 0);
+    return osSavesYmm && (info[1] & (1 << 5));
+#endif
+}
+#endif
+
+
+/// Bits first to last inclusive
+inline quint64 bitRange(int first, int last)
+{
+    const quint64 upTo = last >= 63 ? ~quint64(0) : (quint64(1) << (last + 1)) - 1;
+    return upTo & (~quint64(0) << first);
+}
+
+
+/// The sequential part: works out which bytes are inside strings and comments,
+/// carrying that state from one block to the next
+class Resolver
+{
+   public:
+    Resolver(const char *end, QVector<quint32> &offsets)
+        : m_end(end), m_offsets(offsets), m_state(Normal), m_quote(0), m_level(0), m_skip(0), m_prevScalar(0)
+    {
+    }
+
+    /// @param block Start of this block in the original text
+    /// @param valid Bits of the block which are part of the text
+    void resolve(const char *block, quint32 base, const Masks &m, quint64 valid)
+    {
+        quint64 masked = 0;
+        quint64 stringStarts = 0;
+
+        int regionStart = 0;
+        int pos = 0;
+
+        // The end of a bracket or escape which ran over from the previous block
+        if (m_skip > 0)
+        {
+            pos = qMin(m_skip, blockSize);
+            masked |= bitRange(0, pos - 1);
+            m_skip -= pos;
+        }
+
+        // Only the characters which can change the state are visited
+        while (pos < blockSize)
+        {
+            quint64 candidates = 0;
+            switch (m_state)
+            {
+                case Normal:
+                    candidates = m.doubleQuote | m.singleQuote | m.openBracket | m.dash;
+                    break;
+                case InString:
+                    candidates = (m_quote == '"' ? m.doubleQuote : m.singleQuote) | m.backslash;
+                    break;
+                case InComment:
+                    candidates = m.newline;
+                    break;
+                case InLongBracket:
+                    candidates = m.closeBracket;
+                    break;
+            }
+            candidates &= valid & (~quint64(0) << pos);
+            if (candidates == 0) break;
+
+            const int i = static_cast<int>(qCountTrailingZeroBits(candidates));
+            const char *p = block + i;
+            pos = i + 1;
+
+            switch (m_state)
+            {
+                case Normal:
+                    if (*p == '"' || *p == '\'')
+                    {
+                        stringStarts |= quint64(1) << i;
+                        regionStart = i;
+                        m_quote = *p;
+                        m_state = InString;
+                    }
+                    else if (*p == '[')
+                    {
+                        const int level = longBracketLevel(p, m_end);
+                        if (level >= 0)
+                        {
+                            stringStarts |= quint64(1) << i;
+                            regionStart = i;
+                            m_level = level;
+                            m_state = InLongBracket;
+                            pos = i + level + 2;
+                        }
+                    }
+                    else if (p + 1 < m_end && p[1] == '-')
+                    {
+                        // A comment, which is a block comment if a long bracket follows
+                        regionStart = i;
+                        const int level = longBracketLevel(p + 2, m_end);
+                        if (level >= 0)
+                        {
+                            m_level = level;
+                            m_state = InLongBracket;
+                            pos = i + level + 4;
+                        }
+                        else
+                        {
+                            m_state = InComment;
+                            pos = i + 2;
+                        }
+                    }
+                    break;
+
+                case InString:
+                    if (*p == '\\')
+                    {
+                        // Step over the escaped character, which may be a quote
+                        pos = i + 2;
+                    }
+                    else
+                    {
+                        masked |= bitRange(regionStart, i);
+                        m_state = Normal;
+                    }
+                    break;
+
+                case InComment:
+                    masked |= bitRange(regionStart, i);
+                    m_state = Normal;
+                    break;
+
+                case InLongBracket:
+                    if (findLongBracketClose(p, qMin(m_end, p + m_level + 2), m_level) == p)
+                    {
+                        const int last = i + m_level + 1;
+                        masked |= bitRange(regionStart, qMin(last, blockSize - 1));
+                        m_state = Normal;
+                        pos = last + 1;
+                    }
+                    break;
+            }
+        }
+
+        if (m_state != Normal) masked |= bitRange(regionStart, blockSize - 1);
+        if (pos > blockSize) m_skip = pos - blockSize;
+
+        const quint64 outside = valid & ~masked;
+        const quint64 structural = m.structural & outside;
+        const quint64 scalar = outside & ~m.space & ~m.structural;
+        const quint64 scalarStarts = scalar & ~((scalar << 1) | m_prevScalar);
+        m_prevScalar = scalar >> (blockSize - 1);
+
+        quint64 all = structural | stringStarts | scalarStarts;
+        while (all != 0)
+        {
+            m_offsets.append(base + qCountTrailingZeroBits(all));
+            all &= all - 1;
+        }
+    }
+
+   private:
+    enum State
+    {
+        Normal,
+        InString,
+        InComment,
+        InLongBracket  ///< A long string or block comment
+    };
+
+    const char *m_end;
+    QVector<quint32> &m_offsets;
+    State m_state;
+    char m_quote;  ///< Which quote the string started with
+    int m_level;   ///< Of the long bracket
+    int m_skip;    ///< Characters at the start of the next block which are already accounted for
+    quint64 m_prevScalar;
+};
+
+}  // namespace
+
+
+bool isaSupported(ScanIsa isa)
+{
+    switch (isa)
+    {
+        case ScanIsa::Best:
+        case ScanIsa::Scalar:
+            return true;
+        case ScanIsa::Sse2:
+#ifdef LRT_SCAN_SSE2
+            return true;
+#else
+            return false;
+#endif
+        case ScanIsa::Avx2:
+#ifdef LRT_SCAN_AVX2
+            static const bool avx2 = cpuHasAvx2();
+            return avx2;
+#else
+            return false;
+#endif
+    }
+    return false;
+}
+
+
+StructuralIndex::StructuralIndex() : m_begin(nullptr), m_end(nullptr) {}
+
+StructuralIndex::StructuralIndex(const char *begin, const char *end, ScanIsa isa) : m_begin(begin), m_end(end)
+{
+    if (isa == ScanIsa::Best) isa = isaSupported(ScanIsa::Avx2) ? ScanIsa::Avx2 : (isaSupported(ScanIsa::Sse2) ? ScanIsa::Sse2 : ScanIsa::Scalar);
+    if (!isaSupported(isa)) isa = ScanIsa::Scalar;
+
+    Masks (*classify)(const char *) = classifyScalar;
+#ifdef LRT_SCAN_SSE2
+    if (isa == ScanIsa::Sse2) classify = classifySse2;
+#endif
+#ifdef LRT_SCAN_AVX2
+    if (isa == ScanIsa::Avx2) classify = classifyAvx2;
+#endif
+
+    // Roughly one token in every 8 bytes of a template
+    const long long size = end - begin;
+    m_offsets.reserve(static_cast<int>(size / 8));
+
+    Resolver resolver(end, m_offsets);
+
+    const char *block = begin;
+    for (; end - block >= blockSize; block += blockSize)
+    {
+        resolver.resolve(block, static_cast<quint32>(block - begin), classify(block), ~quint64(0));
+    }
+
+    // Pad the final part-block with spaces, which are never structural
+    if (block != end)
+    {
+        const int remaining = static_cast<int>(end - block);
+        char padded[blockSize];
+        memset(padded, ' ', sizeof(padded));
+        memcpy(padded, block, static_cast<size_t>(remaining));
+        resolver.resolve(block, static_cast<quint32>(block - begin), classify(padded), bitRange(0, remaining - 1));
+    }
+}
+
+const char *StructuralIndex::matchingBrace(const char *open) const
+{
+    if (open < m_begin || open >= m_end || *open != '{') return nullptr;
+
+    const quint32 offset = static_cast<quint32>(open - m_begin);
+    auto it = std::lower_bound(m_offsets.constBegin(), m_offsets.constEnd(), offset);
+    if (it == m_offsets.constEnd() || *it != offset) return nullptr;
+
+    int depth = 0;
+    for (; it != m_offsets.constEnd(); ++it)
+    {
+        const char c = m_begin[*it];
+        if (c == '{')
+        {
+            depth++;
+        }
+        else if (c == '}')
+        {
+            if (--depth == 0) return m_begin + *it;
+        }
+    }
+
+    return nullptr;
+}
+
+};  // namespace LuaParser
@@ -0,0 +1,62 @@
+//  This file is part of LrtEdit.
+//
+// LrtEdit is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// LrtEdit is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LrtEdit.  If not, see <https://www.gnu.org/licenses/>.
+#ifndef LUASCANNER_H
+#define LUASCANNER_H
+
+#include <QVector>
+
+namespace LuaParser
+{
+/// Instruction set used to classify the input
+enum class ScanIsa
+{
+    Best,  ///< The fastest supported by this CPU
+    Scalar,
+    Sse2,
+    Avx2
+};
+
+/// Returns true if the CPU (and this build) can scan with isa
+bool isaSupported(ScanIsa isa);
+
+
+/// Where the tokens are in some lua text, found 64 bytes at a time (in the style of simdjson's stage 1).
+///
+/// The offsets are of every '{', '}', '[', ']', '=', ',' and ';', the opening quote or bracket of each
+/// string, and the first character of every other token (identifiers, numbers and the like). Anything
+/// inside a string or comment is left out. For valid lua these are exactly where the Lexer's tokens
+/// start, and every ISA produces the same offsets.
+class StructuralIndex
+{
+   public:
+    StructuralIndex();
+    StructuralIndex(const char *begin, const char *end, ScanIsa isa = ScanIsa::Best);
+
+    const char *begin() const { return m_begin; }
+    const QVector<quint32> &offsets() const { return m_offsets; }
+
+    /// Find the '}' that closes the '{' at open, using only the offsets.
+    /// Returns nullptr if open is not an indexed '{' or it is never closed.
+    const char *matchingBrace(const char *open) const;
+
+   private:
+    const char *m_begin;
+    const char *m_end;
+    QVector<quint32> m_offsets;
+};
+
+};  // namespace LuaParser
+
+#endif // LUASCANNER_H
@@ -0,0 +1,149 @@
+//  This file is part of LrtEdit.
+//
+// LrtEdit is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// LrtEdit is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LrtEdit.  If not, see <https://www.gnu.org/licenses/>.
+#ifndef LUASCHEMA_H
+#define LUASCHEMA_H
+
+#include "luatable.h"
+
+#include <QVector>
+
+#include <cstddef>
+
+namespace LuaParser
+{
+/// How one field of a struct is kept in a table: where, and how to convert it
+template <typename S>
+struct Field
+{
+    const char *path;                        ///< In the struct's table, e.g. "transform/x"
+    void (*read)(S &s, const Value &value);  ///< nullptr for fields which are only written
+    Value (*write)(const S &s);              ///< nullptr for fields which are only read
+};
+
+/// Reads a struct from a table, and writes it back, as described by a list of fields.
+///
+/// The fields are normally a static constexpr array, e.g.
+///     static constexpr Field<Photo> photoFields[] = {
+///         {"name", [](Photo &p, const Value &v) { p.name = v.toString(); }, nullptr},
+///         {"transform/x", [](Photo &p, const Value &v) { p.x = v.toDouble(); }, [](const Photo &p) { return Value(p.x); }},
+///     };
+///     static const Schema<Photo> photoSchema(photoFields);
+/// The paths are parsed and their keys interned once, when the schema is made. Fields which
+/// share a table (like transform above) are read and written together, so each table in
+/// the paths, and each field, is only looked up once.
+template <typename S>
+class Schema
+{
+   public:
+    template <std::size_t N>
+    explicit Schema(const Field<S> (&fields)[N]) : m_fields(fields)
+    {
+        for (int f = 0; f < static_cast<int>(N); f++)
+        {
+            const Table::Path path(QString::fromUtf8(fields[f].path));
+            Node *node = &m_root;
+            for (int i = 0; i < path.size(); i++) node = child(*node, path.at(i));
+            node->field = f;
+        }
+    }
+
+    /// Set the fields which are in table, leaving the others as they were.
+    /// Returns the number which were there.
+    int read(const Table &table, S &s) const { return read(m_root, table, s); }
+
+    /// Write the fields into table, where they are already. Any which are not there
+    /// are not added, and values which are equal to what is there are left as they were
+    /// (e.g. a number written as "1.50"). Returns the number changed.
+    int write(const S &s, Table &table) const { return write(m_root, s, table); }
+
+   private:
+    struct Node
+    {
+        Table::Path step;  ///< One segment, from the node above
+        int field = -1;
+        QVector<Node> children;
+    };
+
+    static Node *child(Node &node, const Table::Path::Segment &segment)
+    {
+        for (Node &c : node.children)
+        {
+            if (c.step.at(0) == segment) return &c;
+        }
+        node.children.append(Node());
+        node.children.last().step << segment;
+        return &node.children.last();
+    }
+
+    int read(const Node &node, const Table &table, S &s) const
+    {
+        int n = 0;
+        for (const Node &c : node.children)
+        {
+            const Value *value = table.find(c.step.at(0));
+            if (value == nullptr) continue;
+
+            if (c.field >= 0 && m_fields[c.field].read != nullptr)
+            {
+                m_fields[c.field].read(s, *value);
+                n++;
+            }
+            if (!c.children.isEmpty() && value->table() != nullptr) n += read(c, *value->table(), s);
+        }
+        return n;
+    }
+
+    int write(const Node &node, const S &s, Table &table) const
+    {
+        // Everything is compared before it is taken for editing, so that a table whose fields
+        // are unchanged stays shared with any copies of it
+        const Table &current = table;
+        int n = 0;
+        for (const Node &c : node.children)
+        {
+            const Value *value = current.find(c.step.at(0));
+            if (value == nullptr) continue;
+
+            if (c.field >= 0 && m_fields[c.field].write != nullptr)
+            {
+                const Value written = m_fields[c.field].write(s);
+                if (*value != written)
+                {
+                    table.setAttr(c.step, written);
+                    value = current.find(c.step.at(0));
+                    n++;
+                }
+            }
+            if (!c.children.isEmpty() && value->table() != nullptr)
+            {
+                Table inside = *value->table();
+                const int changed = write(c, s, inside);
+                if (changed > 0)
+                {
+                    table.setAttr(c.step, inside);
+                    n += changed;
+                }
+            }
+        }
+        return n;
+    }
+
+    const Field<S> *m_fields;
+    Node m_root;
+};
+
+};  // namespace LuaParser
+
+#endif // LUASCHEMA_H
@@ -0,0 +1,477 @@
+//  This file is part of LrtEdit.
+//
+// LrtEdit is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// LrtEdit is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LrtEdit.  If not, see <https://www.gnu.org/licenses/>.
+#include "luasnapshot.h"
+#include "luanumber.h"
+
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QtEndian>
+
+#include <cstring>
+
+namespace LuaParser
+{
+namespace
+{
+const char magic[4] = {'L', 'R', 'T', 'S'};
+
+// Bump when the format, or what the parser produces for the same text, changes
+const quint64 formatVersion = 2;
+
+// Deeper than any real template, and stops a corrupt snapshot from exhausting the stack
+const int maxDepth = 256;
+
+enum Tag : quint8
+{
+    NullTag,
+    FalseTag,
+    TrueTag,
+    IntTag,     // zig-zag varint
+    DoubleTag,  // 8 bytes, little-endian
+    NumberTag,  // as DoubleTag, then the lexeme
+    StringTag,   // UTF-8
+    ZStringTag,  // UTF-8, without any "ZSTR:" prefix
+    TableTag     // item count, key count, the items, then (key index, value) pairs
+};
+
+QByteArray contentHash(const char *begin, const char *end)
+{
+    return QCryptographicHash::hash(QByteArray::fromRawData(begin, static_cast<int>(end - begin)), QCryptographicHash::Md5);
+}
+
+
+/// Snapshot values are written with the keys replaced by indexes into a table of keys
+class Writer
+{
+   public:
+    void varint(quint64 v)
+    {
+        while (v >= 0x80)
+        {
+            m_out.append(static_cast<char>(v | 0x80));
+            v >>= 7;
+        }
+        m_out.append(static_cast<char>(v));
+    }
+
+    void signedVarint(qint64 v) { varint((static_cast<quint64>(v) << 1) ^ static_cast<quint64>(v >> 63)); }
+
+    void bytes(const QByteArray &b)
+    {
+        varint(static_cast<quint64>(b.size()));
+        m_out.append(b);
+    }
+
+    void tag(Tag t) { m_out.append(static_cast<char>(t)); }
+
+    void real(double d)
+    {
+        quint64 bits;
+        memcpy(&bits, &d, sizeof(bits));
+        bits = qToLittleEndian(bits);
+        m_out.append(reinterpret_cast<const char *>(&bits), sizeof(bits));
+    }
+
+    void value(const Value &v)
+    {
+        switch (v.kind())
+        {
+            case Value::Kind::Null:
+                tag(NullTag);
+                return;
+            case Value::Kind::Bool:
+                tag(v.toBool() ? TrueTag : FalseTag);
+                return;
+            case Value::Kind::Int:
+                tag(IntTag);
+                signedVarint(v.toInt());
+                return;
+            case Value::Kind::Double:
+                tag(DoubleTag);
+                real(v.toDouble());
+                return;
+            case Value::Kind::Number:
+            {
+                const Number n = v.value<Number>();
+                tag(NumberTag);
+                real(n.value());
+                bytes(n.lexeme());
+                return;
+            }
+            case Value::Kind::String:
+            case Value::Kind::ZString:
+                // The kind is in the tag, so that a plain string which happens to start with "ZSTR:" stays one
+                tag(v.kind() == Value::Kind::ZString ? ZStringTag : StringTag);
+                bytes(v.text().toUtf8());
+                return;
+            case Value::Kind::Table:
+            {
+                const Table &t = *v.table();
+
+                tag(TableTag);
+                varint(static_cast<quint64>(t.hash()));
+                varint(static_cast<quint64>(t.atoms().size()));
+                t.forEach([this](const Table::Entry &entry) {
+                    if (entry.key != nullptr) varint(static_cast<quint64>(key(entry.key->toString())));
+                    value(entry.value);
+                });
+                return;
+            }
+        }
+    }
+
+    int key(const QString &name)
+    {
+        auto it = m_keyIndex.constFind(name);
+        if (it != m_keyIndex.constEnd()) return it.value();
+
+        m_keys.append(name);
+        m_keyIndex.insert(name, m_keys.size() - 1);
+        return m_keys.size() - 1;
+    }
+
+    QByteArray m_out;
+    QList<QString> m_keys;
+    QHash<QString, int> m_keyIndex;
+};
+
+
+/// Reads back what Writer wrote, checking everything against the end of the data
+class Reader
+{
+   public:
+    Reader(const char *begin, const char *end) : m_p(begin), m_end(end), m_okay(true) {}
+
+    bool okay() const { return m_okay; }
+
+    quint64 varint()
+    {
+        quint64 v = 0;
+        for (int shift = 0; m_p != m_end && shift < 64; shift += 7)
+        {
+            const quint8 b = static_cast<quint8>(*m_p++);
+            v |= static_cast<quint64>(b & 0x7F) << shift;
+            if ((b & 0x80) == 0) return v;
+        }
+
+        m_okay = false;
+        return 0;
+    }
+
+    qint64 signedVarint()
+    {
+        const quint64 v = varint();
+        return static_cast<qint64>(v >> 1) ^ -static_cast<qint64>(v & 1);
+    }
+
+    /// A count of things which each take at least a byte, so cannot be more than what is left
+    int count()
+    {
+        const quint64 n = varint();
+        if (n > static_cast<quint64>(m_end - m_p))
+        {
+            m_okay = false;
+            return 0;
+        }
+        return static_cast<int>(n);
+    }
+
+    Span bytes()
+    {
+        const quint64 n = varint();
+        if (n > static_cast<quint64>(m_end - m_p))
+        {
+            m_okay = false;
+            return Span();
+        }
+
+        const Span s(m_p, m_p + n);
+        m_p += n;
+        return s;
+    }
+
+    double real()
+    {
+        if (m_end - m_p < 8)
+        {
+            m_okay = false;
+            return 0;
+        }
+
+        quint64 bits;
+        memcpy(&bits, m_p, sizeof(bits));
+        m_p += sizeof(bits);
+        bits = qFromLittleEndian(bits);
+
+        double d;
+        memcpy(&d, &bits, sizeof(d));
+        return d;
+    }
+
+    void keys()
+    {
+        const int n = count();
+        m_keys.reserve(n);
+        for (int i = 0; i < n && m_okay; i++)
+        {
+            const Span k = bytes();
+            m_keys.append(Atom::fromUtf8(k.begin, k.end));
+        }
+    }
+
+    Value value(int depth = 0)
+    {
+        if (m_p == m_end || depth > maxDepth)
+        {
+            m_okay = false;
+            return Value();
+        }
+
+        const Tag tag = static_cast<Tag>(*m_p++);
+        switch (tag)
+        {
+            case NullTag:
+                return Value();
+            case FalseTag:
+                return Value(false);
+            case TrueTag:
+                return Value(true);
+            case IntTag:
+                return Value(static_cast<int>(signedVarint()));
+            case DoubleTag:
+                return Value(real());
+            case NumberTag:
+            {
+                // Copied, as the snapshot is unmapped once it has been read
+                const double d = real();
+                const Span lexeme = bytes();
+                return Value(Number(d, QByteArray(lexeme.begin, lexeme.size())));
+            }
+            case StringTag:
+            case ZStringTag:
+            {
+                const Span s = bytes();
+                return Value::fromUtf8(s.begin, s.end, tag == ZStringTag);
+            }
+            case TableTag:
+            {
+                Table t;
+                const int items = count();
+                const int named = count();
+                for (int i = 0; i < items && m_okay; i++) t.append(value(depth + 1));
+                for (int i = 0; i < named && m_okay; i++)
+                {
+                    const quint64 k = varint();
+                    if (k >= static_cast<quint64>(m_keys.size()))
+                    {
+                        m_okay = false;
+                        break;
+                    }
+                    t[m_keys[static_cast<int>(k)]] = value(depth + 1);
+                }
+                return Value(t);
+            }
+        }
+
+        m_okay = false;
+        return Value();
+    }
+
+   private:
+    const char *m_p;
+    const char *m_end;
+    bool m_okay;
+    QVector<Atom> m_keys;
+};
+
+// Read the header, leaving the reader at the keys
+bool readHeader(Reader &reader, const char *begin, const char *end, SnapshotSource &source)
+{
+    if (end - begin < static_cast<long>(sizeof(magic)) || memcmp(begin, magic, sizeof(magic)) != 0) return false;
+    if (reader.varint() != formatVersion) return false;
+
+    source.size = static_cast<qint64>(reader.varint());
+    source.modified = reader.signedVarint();
+    const Span hash = reader.bytes();
+    source.hash = QByteArray(hash.begin, hash.size());
+    return reader.okay();
+}
+}  // namespace
+
+
+SnapshotSource SnapshotSource::ofFile(const QString &path)
+{
+    const QFileInfo info(path);
+
+    SnapshotSource source;
+    source.size = info.size();
+    source.modified = info.lastModified().toMSecsSinceEpoch();
+    return source;
+}
+
+
+QByteArray writeSnapshot(const NamedVariant &nv, const SnapshotSource &source)
+{
+    Writer body;
+    body.bytes(nv.name().toUtf8());
+    body.value(Value::fromVariant(nv.value()));
+
+    // The keys are only all known once the body has been written
+    Writer header;
+    header.m_out.append(magic, sizeof(magic));
+    header.varint(formatVersion);
+    header.varint(static_cast<quint64>(source.size));
+    header.signedVarint(source.modified);
+    header.bytes(source.hash);
+
+    header.varint(static_cast<quint64>(body.m_keys.size()));
+    for (const QString &k : body.m_keys) header.bytes(k.toUtf8());
+
+    return header.m_out + body.m_out;
+}
+
+bool readSnapshotSource(const char *begin, const char *end, SnapshotSource &source)
+{
+    Reader reader(begin + sizeof(magic), end);
+    return readHeader(reader, begin, end, source);
+}
+
+bool readSnapshot(const char *begin, const char *end, NamedVariant &nv)
+{
+    SnapshotSource source;
+    Reader reader(begin + sizeof(magic), end);
+    if (!readHeader(reader, begin, end, source)) return false;
+
+    reader.keys();
+    const Span name = reader.bytes();
+    const Value value = reader.value();
+    if (!reader.okay()) return false;
+
+    nv = NamedVariant(name.toString(), value.toVariant());
+    return true;
+}
+
+
+SnapshotCache::SnapshotCache(const QString &directory) : m_directory(directory), m_hits(0), m_misses(0) {}
+
+QString SnapshotCache::defaultDirectory()
+{
+    return QDir(QStandardPaths::writableLocation(QStandardPaths::CacheLocation)).filePath("snapshots");
+}
+
+QString SnapshotCache::snapshotPath(const QString &path) const
+{
+    const QByteArray key = QCryptographicHash::hash(QFileInfo(path).absoluteFilePath().toUtf8(), QCryptographicHash::Md5);
+    return QDir(m_directory).filePath(QString::fromLatin1(key.toHex()) + ".snapshot");
+}
+
+NamedVariant SnapshotCache::read(const QString &path)
+{
+    SnapshotSource source = SnapshotSource::ofFile(path);
+
+    // Only the text needs reading to check a changed time, so keep hold of it in case it has to be parsed
+    QFile f(path);
+    const char *text = nullptr;
+    QByteArray buffered;
+    auto readText = [&]() -> bool {
+        if (text != nullptr) return true;
+        if (!f.open(QIODevice::ReadOnly))
+        {
+            qCritical() << "Error opening file for reading:" << path;
+            return false;
+        }
+
+        const uchar *data = f.size() > 0 ? f.map(0, f.size()) : nullptr;
+        if (data != nullptr)
+        {
+            text = reinterpret_cast<const char *>(data);
+        }
+        else
+        {
+            buffered = f.readAll();
+            text = buffered.constData();
+        }
+        source.size = f.size();
+        source.hash = contentHash(text, text + source.size);
+        return true;
+    };
+
+    {
+        QFile snapshot(snapshotPath(path));
+        uchar *data = nullptr;
+        if (snapshot.open(QIODevice::ReadOnly) && snapshot.size() > 0) data = snapshot.map(0, snapshot.size());
+        if (data != nullptr)
+        {
+            const char *begin = reinterpret_cast<const char *>(data);
+            const char *end = begin + snapshot.size();
+
+            SnapshotSource cached;
+            if (readSnapshotSource(begin, end, cached) && cached.size == source.size)
+            {
+                // A different time may just mean the file was copied or restored, so check the contents
+                const bool touched = cached.modified != source.modified;
+                const bool valid = !touched || (readText() && source.hash == cached.hash);
+
+                NamedVariant nv;
+                if (valid && readSnapshot(begin, end, nv))
+                {
+                    m_hits++;
+                    qDebug() << "Read" << path << "from snapshot" << snapshot.fileName();
+
+                    snapshot.unmap(data);
+                    snapshot.close();
+                    if (touched) store(path, nv, source);
+                    return nv;
+                }
+            }
+        }
+    }
+
+    m_misses++;
+    if (!readText()) return NamedVariant();
+
+    qDebug() << "Read" << source.size << "bytes from" << path;
+    const NamedVariant nv = parseLuaStruct(text, text + source.size);
+    if (!nv.name().isEmpty()) store(path, nv, source);
+    return nv;
+}
+
+bool SnapshotCache::store(const QString &path, const NamedVariant &nv, const SnapshotSource &source)
+{
+    if (!QDir().mkpath(m_directory))
+    {
+        qWarning() << "Unable to create snapshot directory" << m_directory;
+        return false;
+    }
+
+    // Written to one side and renamed, so a reader never sees half a snapshot
+    QSaveFile f(snapshotPath(path));
+    if (!f.open(QIODevice::WriteOnly) || f.write(writeSnapshot(nv, source)) < 0 || !f.commit())
+    {
+        qWarning() << "Unable to write snapshot for" << path << "to" << f.fileName();
+        return false;
+    }
+
+    return true;
+}
+
+};  // namespace LuaParser
@@ -0,0 +1,81 @@
+//  This file is part of LrtEdit.
+//
+// LrtEdit is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// LrtEdit is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LrtEdit.  If not, see <https://www.gnu.org/licenses/>.
+#ifndef LUASNAPSHOT_H
+#define LUASNAPSHOT_H
+
+#include "luaparser.h"
+
+#include <QByteArray>
+#include <QString>
+
+namespace LuaParser
+{
+/// Identifies the text a snapshot was made from
+struct SnapshotSource
+{
+    qint64 size = 0;
+    qint64 modified = 0;  ///< Milliseconds since the epoch
+    QByteArray hash;      ///< Of the whole text
+
+    /// The size and modification time of a file, without reading it
+    static SnapshotSource ofFile(const QString &path);
+};
+
+/// Serialise a parsed structure to a compact binary snapshot
+QByteArray writeSnapshot(const NamedVariant &nv, const SnapshotSource &source);
+
+/// Read just the header of a snapshot. Returns false if it is not a snapshot this build can read.
+bool readSnapshotSource(const char *begin, const char *end, SnapshotSource &source);
+
+/// Read the structure back from a snapshot. Returns false if the snapshot is corrupt.
+bool readSnapshot(const char *begin, const char *end, NamedVariant &nv);
+
+
+/// readLuaStruct() with a per-user cache of binary snapshots in front of it.
+///
+/// Snapshots are keyed on the file's path, and are used while the file has the same size and
+/// modification time. If only the time has changed, the content hash is compared before the
+/// file is parsed again. Snapshots are read through a memory mapping, and the text is only
+/// parsed when there is no usable snapshot.
+class SnapshotCache
+{
+   public:
+    /// @param directory Where snapshots are kept, created if need be
+    explicit SnapshotCache(const QString &directory = defaultDirectory());
+
+    /// The snapshots directory under the user's cache location
+    static QString defaultDirectory();
+
+    /// As readLuaStruct(), but from a snapshot if there is a valid one
+    NamedVariant read(const QString &path);
+
+    /// Where the snapshot for a file is kept
+    QString snapshotPath(const QString &path) const;
+
+    /// Number of reads answered from a snapshot or by parsing, which are only really of interest to tests
+    int hits() const { return m_hits; }
+    int misses() const { return m_misses; }
+
+   private:
+    bool store(const QString &path, const NamedVariant &nv, const SnapshotSource &source);
+
+    QString m_directory;
+    int m_hits;
+    int m_misses;
+};
+
+};  // namespace LuaParser
+
+#endif // LUASNAPSHOT_H
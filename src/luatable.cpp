@@ -1,145 +1,208 @@
 #include "luatable.h"
 #include <QDebug>
+#include <QStringList>
+
+#include <algorithm>
 
 namespace LuaParser
 {
-const QVariant &LuaParser::Table::operator[](int index) const
+Table::Table() : d(new Data)
 {
-    if (index > 0 && index <= list.size())
+}
+
+const Value &LuaParser::Table::operator[](int index) const
+{
+    if (const Value *value = find(index))
     {
-        return list.at(index - 1);
+        return *value;
     }
     else
     {
-        qCritical() << "Index out of range:" << index << ", valid const range is 1 to" << this->list.size();
+        qCritical() << "Index out of range:" << index << ", valid const range is 1 to" << d->list.size();
         throw QException();
     }
 }
 
-QVariant &Table::operator[](int index)
+Value &Table::operator[](int index)
 {
-    if (index > 0 && index <= list.size() + 1)  // Allow one to be added!
+    if (index > 0 && index <= d->list.size() + 1)  // Allow one to be added!
     {
-        return list[index - 1];
+        Data *data = edit();
+        if (index == data->list.size() + 1) data->list.append(Value());
+        return data->list[index - 1];
     }
     else
     {
-        qCritical() << "Index out of range:" << index << ", valid non-const range is 1 to" << this->list.size() + 1;
+        qCritical() << "Index out of range:" << index << ", valid non-const range is 1 to" << d->list.size() + 1;
         throw QException();
     }
 }
 
-const QVariant Table::operator[](const QString &index) const
+const Value &Table::operator[](const QString &index) const
 {
-    if (dictionary.contains(index))
+    if (const Value *value = find(index))
     {
-        return dictionary[index];
+        return *value;
     }
     else
     {
         qCritical() << "Invalid index '" + index + "' in const string index lookup.";
-        qDebug() << "Valid keys are:" << dictionary.keys().join(',');
+        qDebug() << "Valid keys are:" << keys().join(',');
         throw QException();
     }
 }
 
-QVariant &Table::operator[](const QString &index)
+Value &Table::operator[](const QString &index)
 {
-    return dictionary[index];
+    Data *data = edit();
+    return data->values[data->insert(Atom(index))];
 }
 
-void Table::append(const QVariant &value)
+const Value &Table::operator[](const Atom &index) const
 {
-    list.append(value);
+    if (const Value *value = find(index))
+    {
+        return *value;
+    }
+    else
+    {
+        qCritical() << "Invalid index '" + index.toString() + "' in const atom index lookup.";
+        qDebug() << "Valid keys are:" << keys().join(',');
+        throw QException();
+    }
 }
 
-int Table::hash() const
+Value &Table::operator[](const Atom &index)
 {
-    return list.size();
+    Data *data = edit();
+    return data->values[data->insert(index)];
 }
 
-QList<QString> Table::keys() const
+const Value *Table::find(int index) const
 {
-    return dictionary.keys();
+    return index > 0 && index <= d->list.size() ? &d->list.at(index - 1) : nullptr;
 }
 
+const Value *Table::find(const Atom &key) const
+{
+    const int i = d->find(key);
+    return i >= 0 ? &d->values.at(i) : nullptr;
+}
 
-const QVariant Table::getAttr(const QString &attr) const
+const Value *Table::find(const QString &key) const
 {
-    int pos = attr.indexOf('/');
-    if (pos > 0)
-    {
-        const QString a = attr.left(pos);
-        const QString b = attr.mid(pos + 1);
+    // A key which has never been interned cannot be in any table
+    const Atom atom = Atom::find(key);
+    return atom.isNull() ? nullptr : find(atom);
+}
 
-        // More of the path to go
-        if (a[0].isDigit())
-            return (*this)[a.toInt()].value<Table>().getAttr(b);
-        else
-            return (*this)[a].value<Table>().getAttr(b);
-    }
-    else
-    {
-        // Just been asked for the leaf
-        if (attr[0].isDigit())
-            return (*this)[attr.toInt()];
-        else
-            return (*this)[attr];
-    }
+const Value *Table::find(const Path::Segment &segment) const
+{
+    return segment.isIndex() ? find(segment.index()) : find(segment.key());
 }
 
-/// @note Currently unable to extend lists or add new attributes with this
-///  function (the asserts will fire if you try)
-void Table::setAttr(const QString &attr, const QVariant &value)
-{
-  // qDebug() << "setAttr(" << attr << ", " << value.toString() << ")";
-  int pos = attr.indexOf('/');
-  if (pos > 0)
-  {
-    const QString a = attr.left(pos);
-    const QString b = attr.mid(pos + 1);
-
-    // More of the path to go.
-    // This is more complicated than you might think as QVariant::value<>()
-    // returns a converted copy and not a reference, so we have to recurse
-    // and set the updated temporary table.
-    if (a[0].isDigit())
-    {
-      const int index = a.toInt();
-      Q_ASSERT(index > 0);
-      Q_ASSERT(index <= this->list.size());
-      // Need to make a copy of the value, update it and then write it back again
-      auto t = this->list[index - 1].value<Table>();
-      t.setAttr(b, value);
-      this->list[index - 1].setValue(t);
-    }
-    else
-    {
-      Q_ASSERT(this->dictionary.contains(a));
-      auto t = this->dictionary[a].value<Table>();
-      t.setAttr(b, value);
-      this->dictionary[a].setValue(t);
-    }
-  }
-  else
-  {
-    // Just been asked for the leaf
-    if (attr[0].isDigit())
+const Value *Table::find(const Path &path) const
+{
+    // Nothing is copied on the way down, the tables are looked at where they are
+    const Table *table = this;
+    const Value *value = nullptr;
+    for (int i = 0; i < path.size(); i++)
     {
-      const int index = attr.toInt();
-      Q_ASSERT(index > 0);
-      Q_ASSERT(index <= this->list.size());
-      this->list[index - 1].setValue(value);
+        if (i > 0)
+        {
+            table = value->table();
+            if (table == nullptr) return nullptr;
+        }
+        value = table->find(path.at(i));
+        if (value == nullptr) return nullptr;
     }
-    else
+    return value;
+}
+
+void Table::append(const Value &value)
+{
+    edit()->list.append(value);
+}
+
+void Table::append(Value &&value)
+{
+    edit()->list.append(std::move(value));
+}
+
+void Table::reserve(int items, int named)
+{
+    Data *data = edit();
+    data->list.reserve(items);
+    data->keys.reserve(named);
+    data->values.reserve(named);
+}
+
+int Table::hash() const
+{
+    return d->list.size();
+}
+
+bool Table::operator==(const Table &other) const
+{
+    if (d == other.d) return true;
+
+    const quint64 hash = d->hash.loadAcquire();
+    const quint64 otherHash = other.d->hash.loadAcquire();
+    if (hash != 0 && otherHash != 0 && hash != otherHash) return false;
+
+    if (d->list != other.d->list || d->keys.size() != other.d->keys.size()) return false;
+
+    // Lua tables have no order, so the keys can have been added in any order
+    for (int i = 0; i < d->keys.size(); i++)
     {
-      Q_ASSERT(this->dictionary.contains(attr));
-      this->dictionary[attr].setValue(value);
+        const int j = other.d->find(d->keys.at(i));
+        if (j < 0 || d->values.at(i) != other.d->values.at(j)) return false;
     }
-  }
+    return true;
+}
+
+quint64 Table::contentHash() const
+{
+    quint64 hash = d->hash.loadAcquire();
+    if (hash != 0) return hash;
+
+    // Items in order, then the named entries, which can be in any order so are summed
+    hash = Value::mixHash(d->list.size());
+    quint64 named = d->keys.size();
+    forEach([&](const Entry &entry) {
+        if (entry.isIndex())
+            hash = Value::mixHash(hash + entry.value.contentHash());
+        else
+            named += Value::mixHash(qHash(entry.key->toUtf8()) + entry.value.contentHash());
+    });
+    hash = Value::mixHash(hash ^ Value::mixHash(named));
+
+    // Two threads may both work it out, but they will store the same value
+    if (hash == 0) hash = 1;
+    if (!d->exposed) d->hash.storeRelease(hash);
+    return hash;
+}
+
+QList<QString> Table::keys() const
+{
+    QList<QString> names;
+    names.reserve(d->keys.size());
+    for (const Atom &key : d->keys) names.append(key.toString());
+    return names;
+}
 
-  // Check we got what we wanted (at least while developing)
-  Q_ASSERT(getAttr(attr) == value);
+
+const Value Table::getAttr(const QString &attr) const
+{
+    return getAttr(Path(attr));
+}
+
+/// @note Currently unable to extend lists or add new attributes with this
+///  function (an exception is thrown if you try)
+void Table::setAttr(const QString &attr, const Value &value)
+{
+    // qDebug() << "setAttr(" << attr << ", " << value.toString() << ")";
+    setAttr(Path(attr), value);
 }
 
 QString Table::getString(const QString &attr) const
@@ -173,4 +236,226 @@ int Table::getSequenceSize(const QString &attr) const
     return getTable(attr).hash();
 }
 
+const Value Table::getAttr(const Path &path) const
+{
+    Q_ASSERT(!path.isEmpty());
+
+    const Value *value = find(path);
+    if (value == nullptr)
+    {
+        qCritical() << "Invalid path '" + path.toString() + "' in getAttr.";
+        throw QException();
+    }
+    return *value;
+}
+
+void Table::setAttr(const Path &path, const Value &value)
+{
+    // The value is set straight away, which edit() has already forgotten the hashes for
+    Value *v = ref(path, false);
+    if (v == nullptr)
+    {
+        qCritical() << "Invalid path '" + path.toString() + "' in setAttr.";
+        throw QException();
+    }
+    *v = value;
+}
+
+QString Table::getString(const Path &path) const
+{
+    return getAttr(path).toString();
+}
+
+int Table::getInt(const Path &path) const
+{
+    return getAttr(path).toInt();
+}
+
+double Table::getDouble(const Path &path) const
+{
+    return getAttr(path).toDouble();
+}
+
+Table Table::getTable(const Path &path) const
+{
+    return getAttr(path).value<Table>();
+}
+
+Value *Table::ref(const Path &path)
+{
+    return ref(path, true);
+}
+
+Value *Table::ref(const Path &path, bool expose)
+{
+    Q_ASSERT(!path.isEmpty());
+
+    Table *table = this;
+    Value *value = nullptr;
+    for (int i = 0; i < path.size(); i++)
+    {
+        if (i > 0)
+        {
+            // Its slot() detaches it from any copies
+            table = value->table();
+            if (table == nullptr) return nullptr;
+        }
+        value = table->slot(path.at(i));
+        if (value == nullptr) return nullptr;
+        if (expose) table->d->exposed = true;
+    }
+    return value;
+}
+
+Table *Table::refTable(const Path &path)
+{
+    if (path.isEmpty()) return this;
+
+    Value *value = ref(path);
+    return value != nullptr ? value->table() : nullptr;
+}
+
+int Table::apply(const Edits &edits)
+{
+    return apply(edits.m_edits.constData(), edits.m_edits.constData() + edits.size(), 0);
+}
+
+int Table::apply(const Edit *begin, const Edit *end, int depth)
+{
+    int applied = 0;
+    while (begin != end)
+    {
+        // The run of edits which go through the same value as this one
+        const Path::Segment &segment = begin->first.at(depth);
+        const Edit *next = begin + 1;
+        while (next != end && next->first.at(depth) == segment) next++;
+
+        Value *value = slot(segment);
+        for (const Edit *edit = begin; value != nullptr && edit != next;)
+        {
+            if (edit->first.size() == depth + 1)
+            {
+                *value = edit->second;
+                applied++;
+                edit++;
+            }
+            else
+            {
+                const Edit *inside = edit + 1;
+                while (inside != next && inside->first.size() > depth + 1) inside++;
+
+                Table *table = value->table();
+                if (table != nullptr) applied += table->apply(edit, inside, depth + 1);
+                edit = inside;
+            }
+        }
+        begin = next;
+    }
+    return applied;
+}
+
+Value *Table::slot(const Path::Segment &segment)
+{
+    // Look before detaching, so that a bad path leaves any copies shared
+    const Data &data = *d.constData();
+    if (segment.isIndex())
+    {
+        return segment.index() <= data.list.size() ? &edit()->list[segment.index() - 1] : nullptr;
+    }
+    else
+    {
+        const int i = data.find(segment.key());
+        return i >= 0 ? &edit()->values[i] : nullptr;
+    }
+}
+
+Table::Data *Table::edit()
+{
+    // Whatever is changed, the hash has to be worked out again
+    Data *data = d.data();
+    data->hash.storeRelease(0);
+    return data;
+}
+
+Table::Data::Data(const Data &other)
+    : QSharedData(other),
+      list(other.list),
+      keys(other.keys),
+      values(other.values),
+      index(other.index),
+      hash(other.hash.loadAcquire()),
+      exposed(false)
+{
+}
+
+// Beyond this many keys a table is indexed, rather than searched
+static const int indexedSize = 16;
+
+int Table::Data::find(const Atom &key) const
+{
+    if (!index.isEmpty()) return index.value(key, -1);
+
+    const auto it = std::find(keys.constBegin(), keys.constEnd(), key);
+    return it != keys.constEnd() ? static_cast<int>(it - keys.constBegin()) : -1;
+}
+
+int Table::Data::insert(const Atom &key)
+{
+    const int i = find(key);
+    if (i >= 0) return i;
+
+    keys.append(key);
+    values.append(Value());
+    if (!index.isEmpty())
+    {
+        index.insert(key, keys.size() - 1);
+    }
+    else if (keys.size() > indexedSize)
+    {
+        for (int k = 0; k < keys.size(); k++) index.insert(keys.at(k), k);
+    }
+    return keys.size() - 1;
+}
+
+void Table::Edits::set(const Path &path, const Value &value)
+{
+    Q_ASSERT(!path.isEmpty());
+    m_edits.append(qMakePair(path, value));
+}
+
+Table::Path::Path(const QString &path)
+{
+    if (path.isEmpty()) return;
+
+    const QStringList parts = path.split('/');
+    m_segments.reserve(parts.size());
+    for (const QString &part : parts)
+    {
+        if (!part.isEmpty() && part[0].isDigit())
+            m_segments.append(part.toInt());
+        else
+            m_segments.append(Atom(part));
+    }
+}
+
+Table::Path &Table::Path::operator<<(const Segment &segment)
+{
+    m_segments.append(segment);
+    return *this;
+}
+
+Table::Path Table::Path::operator+(const Path &other) const
+{
+    Path path(*this);
+    path.m_segments += other.m_segments;
+    return path;
+}
+
+QString Table::Path::toString() const
+{
+    QStringList parts;
+    for (const Segment &segment : m_segments) parts.append(segment.isIndex() ? QString::number(segment.index()) : segment.key().toString());
+    return parts.join('/');
+}
+
 };  // namespace LuaParser
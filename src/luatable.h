@@ -15,41 +15,188 @@
 #ifndef LUATABLE_H
 #define LUATABLE_H
 
+#include "luaatom.h"
+#include "luavalue.h"
+
+#include <QAtomicInteger>
 #include <QException>
+#include <QHash>
 #include <QIODevice>
 #include <QPair>
+#include <QSharedData>
 #include <QVariant>
 #include <QVector>
 
+#include <optional>
+
 namespace LuaParser
 {
 /// A Lua table is a mix of a sequence and an associative type.
 /// There is scope for making this more uniform (associative array
 /// mapping with an "int or string" index type)
+///
+/// Tables are implicitly shared, like Qt's containers: copying one (or taking
+/// it out of a Value or QVariant) only bumps a reference count, and the contents
+/// are copied the first time a shared copy is modified.
 class Table
 {
    public:
+    /// A path into nested tables, such as "pages/3/1/children", parsed once so that it can be
+    /// reused without any string handling on each access.
+    ///
+    /// Segments which start with a digit are (unity-based) list indexes, all others are keys.
+    class Path
+    {
+       public:
+        class Segment
+        {
+           public:
+            Segment(int index) : m_index(index) {}
+            Segment(const Atom &key) : m_index(0), m_key(key) {}
+            Segment(const QString &key) : m_index(0), m_key(key) {}
+            Segment(const char *key) : m_index(0), m_key(QString::fromUtf8(key)) {}
+
+            bool isIndex() const { return m_index > 0; }
+            int index() const { return m_index; }
+            const Atom &key() const { return m_key; }
+
+            bool operator==(const Segment &other) const { return m_index == other.m_index && m_key == other.m_key; }
+
+           private:
+            int m_index;
+            Atom m_key;
+        };
+
+        Path() {}
+
+        /// Parse a '/' separated path, the empty string being the empty path
+        explicit Path(const QString &path);
+
+        /// e.g. Path{"pages", page, 1, "children"}
+        Path(std::initializer_list<Segment> segments) : m_segments(segments) {}
+
+        bool isEmpty() const { return m_segments.isEmpty(); }
+        int size() const { return m_segments.size(); }
+        const Segment &at(int i) const { return m_segments.at(i); }
+
+        Path &operator<<(const Segment &segment);
+        Path operator+(const Path &other) const;
+
+        bool operator==(const Path &other) const { return m_segments == other.m_segments; }
+
+        QString toString() const;
+
+       private:
+        QVector<Segment> m_segments;
+    };
+
+    using Edit = QPair<Path, Value>;
+
+    /// A list of changes to make with apply()
+    class Edits
+    {
+       public:
+        /// Set the value at path, which must not be empty
+        void set(const Path &path, const Value &value);
+
+        bool isEmpty() const { return m_edits.isEmpty(); }
+        int size() const { return m_edits.size(); }
+        void clear() { m_edits.clear(); }
+
+       private:
+        friend class Table;
+        QVector<Edit> m_edits;
+    };
+
+    /// What forEach() passes for each entry of a table
+    struct Entry
+    {
+        int index;         ///< Unity-based position of a list item, or 0 for a named entry
+        const Atom *key;   ///< Name of a named entry, or nullptr for a list item
+        const Value &value;
+        Value::Kind kind;  ///< That of value, which visitors usually switch on
+
+        bool isIndex() const { return key == nullptr; }
+        Path::Segment segment() const { return key != nullptr ? Path::Segment(*key) : Path::Segment(index); }
+    };
+
+    Table();
+
     /// Indexing sequences is unity-indexed
-    const QVariant &operator[](int index) const;
+    const Value &operator[](int index) const;
 
     /// Indexing sequences is unity-indexed
-    QVariant &operator[](int index);
+    Value &operator[](int index);
+
+    const Value &operator[](const QString &index) const;
 
-    const QVariant operator[](const QString &index) const;
+    Value &operator[](const QString &index);
 
-    QVariant &operator[](const QString &index);
+    /// Key lookups without going via the key's text
+    const Value &operator[](const Atom &index) const;
+    Value &operator[](const Atom &index);
 
-    void append(const QVariant &value);
+    void append(const Value &value);
+    void append(Value &&value);
+
+    /// Make room for this many list items and named entries, when they are known before filling the table
+    void reserve(int items, int named);
 
     // Return the equivalent of the lua # operator and count the list elements
     int hash() const;
 
+    /// Named keys, in the order they were added (for a parsed table, the order in the file)
     QList<QString> keys() const;
 
+    /// As keys(), without converting them to text
+    const QVector<Atom> &atoms() const { return d->keys; }
+
+    /// True if there is a value with this name
+    bool contains(const Atom &key) const { return d->find(key) >= 0; }
+
+    /// The value for a (unity-based) list index, key or path, or nullptr if there is none.
+    /// Unlike operator[] and getAttr() these never log or throw, and (other than to convert
+    /// a const char * key) nothing is allocated, so they are the ones to probe for optional
+    /// values with. The pointer is valid until this table is next changed.
+    const Value *find(int index) const;
+    const Value *find(const Atom &key) const;
+    const Value *find(const QString &key) const;
+    const Value *find(const char *key) const { return find(QString::fromUtf8(key)); }
+    const Value *find(const Path::Segment &segment) const;
+    const Value *find(const Path &path) const;
+
+    /// The value at path, if there is one which can be converted to T
+    template <typename T>
+    std::optional<T> tryGet(const Path &path) const
+    {
+        const Value *value = find(path);
+        if (value == nullptr || !value->canConvert<T>()) return std::nullopt;
+        return value->value<T>();
+    }
+
+    /// Call visit(entry) for each list item, in order, then for each named entry, in the order
+    /// they were added. Entries are passed where they are, so nothing is copied or allocated;
+    /// the table must not be changed until it returns.
+    template <typename Visitor>
+    void forEach(Visitor &&visit) const
+    {
+        const Data &data = *d;
+        for (int i = 0; i < data.list.size(); i++)
+        {
+            const Value &value = data.list.at(i);
+            visit(Entry{i + 1, nullptr, value, value.kind()});
+        }
+        for (int i = 0; i < data.keys.size(); i++)
+        {
+            const Value &value = data.values.at(i);
+            visit(Entry{0, &data.keys.at(i), value, value.kind()});
+        }
+    }
+
     /// Path-based variant accessor.
     ///
-    const QVariant getAttr(const QString &attr) const;
-    void setAttr(const QString &attr, const QVariant &value);
+    const Value getAttr(const QString &attr) const;
+    void setAttr(const QString &attr, const Value &value);
 
     /// Path-based string accessor
     QString getString(const QString &attr) const;
@@ -61,17 +208,94 @@ class Table
 
     Table getTable(const QString &attr) const;
 
+    /// As above, with a path which has already been parsed
+    const Value getAttr(const Path &path) const;
+    void setAttr(const Path &path, const Value &value);
+    QString getString(const Path &path) const;
+    int getInt(const Path &path) const;
+    double getDouble(const Path &path) const;
+    Table getTable(const Path &path) const;
+
+    /// The value at path, for editing in place, or nullptr if there is nothing there.
+    /// Only the tables along the path are detached from any copies. The pointer is
+    /// valid until this table is next changed or copied. As the value can be changed
+    /// at any time through it, the tables along the path stop keeping their content
+    /// hash, and work it out each time it is asked for, until they are next detached.
+    Value *ref(const Path &path);
+
+    /// As ref(), for a table. An empty path refers to this table.
+    Table *refTable(const Path &path);
+
+    /// Make the edits in order, as setAttr() would, but in one walk down the tree: edits in a
+    /// row which go through the same tables only look each of them up once. Set them table by
+    /// table (as the document is laid out) to get the most from that.
+    /// Returns the number made: edits whose path does not exist are skipped.
+    int apply(const Edits &edits);
+
     /// Return the number of list elements for the Table specified by attr
     int getSequenceSize(const QString &attr) const;
 
+    /// True if both tables refer to the same, not yet detached, contents
+    bool isSharedWith(const Table &other) const { return d == other.d; }
+
+    /// A hash of the items and keys and their values, which is the same for equal tables.
+    /// It is worked out from those of the tables inside this one, and kept until this
+    /// table (or one inside it) is edited, so asking again is quick.
+    quint64 contentHash() const;
+
+    /// Same items and keys, with equal values. Tables whose hashes are known and differ
+    /// are not looked inside.
+    bool operator==(const Table &other) const;
+    bool operator!=(const Table &other) const { return !(*this == other); }
+
    private:
-    QVariantList list;
-    QVariantMap dictionary;
+    Value *slot(const Path::Segment &segment);
+    Value *ref(const Path &path, bool expose);
+    int apply(const Edit *begin, const Edit *end, int depth);
+
+    class Data : public QSharedData
+    {
+       public:
+        Data() : exposed(false) {}
+
+        /// A copy which nothing else can have a pointer into yet
+        Data(const Data &other);
+
+        QVector<Value> list;
+
+        // Named entries, in the order they were added. Most tables have a handful of keys,
+        // which are found by a scan of keys; bigger ones also get an index.
+        QVector<Atom> keys;
+        QVector<Value> values;
+        QHash<Atom, int> index;
+
+        /// contentHash(), or 0 if it has not been worked out since the last edit
+        mutable QAtomicInteger<quint64> hash;
+
+        /// A pointer into it has been handed out by ref(), through which it can change without
+        /// an edit(), so hash is not kept
+        bool exposed;
+
+        /// Position of key in keys and values, or -1
+        int find(const Atom &key) const;
+
+        /// Position of key, adding it (with a nil value) if it is not already there
+        int insert(const Atom &key);
+    };
+
+    /// Detach for editing, which also forgets the content hash
+    Data *edit();
+
+    QSharedDataPointer<Data> d;
 };
 
+/// So that tables can be kept in a QHash or QSet, e.g. to find the pages which have the same layout
+inline uint qHash(const Table &table, uint seed = 0) { return static_cast<uint>(table.contentHash() ^ (table.contentHash() >> 32)) ^ seed; }
 
 };  // namespace LuaParser
 
+// A Table is a single pointer, so QVariant can hold it without an allocation of its own
+Q_DECLARE_TYPEINFO(LuaParser::Table, Q_MOVABLE_TYPE);
 Q_DECLARE_METATYPE(LuaParser::Table);
 
 #endif // LUATABLE_H
@@ -0,0 +1,526 @@
+//  This file is part of LrtEdit.
+//
+// LrtEdit is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// LrtEdit is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LrtEdit.  If not, see <https://www.gnu.org/licenses/>.
+#include "luavalue.h"
+#include "luanumber.h"
+#include "luatable.h"
+
+#include <charconv>
+#include <cstring>
+
+namespace LuaParser
+{
+static_assert(sizeof(Table) <= sizeof(QString), "A Table has to fit where a long string goes");
+
+namespace
+{
+// The value of a number's original text, which may be hex
+double lexemeValue(const QByteArray &lexeme)
+{
+    const char *begin = lexeme.constData();
+    const char *end = begin + lexeme.size();
+    const char *digits = begin + (begin != end && begin[0] == '-' ? 1 : 0);
+    if (end - digits > 2 && digits[0] == '0' && (digits[1] | 0x20) == 'x')
+    {
+        long long hex = 0;
+        std::from_chars(digits + 2, end, hex, 16);
+        return static_cast<double>(digits == begin ? hex : -hex);
+    }
+
+    double d = 0;
+    parseDouble(begin, end, d);
+    return d;
+}
+}  // namespace
+
+
+Value::Value(bool b)
+{
+    m_data[0] = static_cast<unsigned char>(Kind::Bool);
+    *payload<bool>() = b;
+}
+
+Value::Value(int i)
+{
+    m_data[0] = static_cast<unsigned char>(Kind::Int);
+    *payload<int>() = i;
+}
+
+Value::Value(double d)
+{
+    m_data[0] = static_cast<unsigned char>(Kind::Double);
+    *payload<double>() = d;
+}
+
+Value::Value(const Number &n)
+{
+    m_data[0] = static_cast<unsigned char>(Kind::Number);
+    new (payload<QByteArray>()) QByteArray(n.lexeme());
+}
+
+Value::Value(const Table &t)
+{
+    m_data[0] = static_cast<unsigned char>(Kind::Table);
+    new (payload<Table>()) Table(t);
+}
+
+Value::Value(const QString &s)
+{
+    if (s.startsWith(QLatin1String("ZSTR:")))
+        setString(Kind::ZString, s.mid(5));
+    else
+        setString(Kind::String, s);
+}
+
+Value Value::fromUtf8(const char *begin, const char *end, bool zstr)
+{
+    Value v;
+    const Kind kind = zstr ? Kind::ZString : Kind::String;
+    const long long size = end - begin;
+    if (size <= smallSize)
+    {
+        v.m_data[0] = static_cast<unsigned char>(kind);
+        v.m_data[1] = static_cast<unsigned char>(size);
+        if (size > 0) memcpy(v.m_data + 2, begin, static_cast<size_t>(size));
+    }
+    else
+    {
+        v.setString(kind, QString::fromUtf8(begin, static_cast<int>(size)));
+    }
+    return v;
+}
+
+Value Value::fromString(const QString &s, bool zstr)
+{
+    Value v;
+    v.setString(zstr ? Kind::ZString : Kind::String, s);
+    return v;
+}
+
+void Value::setString(Kind kind, const QString &s)
+{
+    m_data[0] = static_cast<unsigned char>(kind);
+
+    // Short ASCII goes in place as is, anything else would need converting to find its size
+    if (s.size() <= smallSize)
+    {
+        int i = 0;
+        while (i < s.size() && s.at(i).unicode() < 0x80)
+        {
+            m_data[2 + i] = static_cast<unsigned char>(s.at(i).unicode());
+            i++;
+        }
+        if (i == s.size())
+        {
+            m_data[1] = static_cast<unsigned char>(i);
+            return;
+        }
+    }
+
+    m_data[1] = longString;
+    new (payload<QString>()) QString(s);
+}
+
+Value Value::fromVariant(const QVariant &v)
+{
+    if (v.userType() == qMetaTypeId<Table>()) return Value(v.value<Table>());
+    if (v.userType() == qMetaTypeId<Number>()) return Value(v.value<Number>());
+
+    switch (v.userType())
+    {
+        case QMetaType::Bool:
+            return Value(v.toBool());
+        case QMetaType::Int:
+            return Value(v.toInt());
+        case QMetaType::UInt:
+        case QMetaType::LongLong:
+        case QMetaType::ULongLong:
+        case QMetaType::Double:
+            return Value(v.toDouble());
+        case QMetaType::QString:
+            return Value(v.toString());
+        default:
+            return Value();
+    }
+}
+
+QVariant Value::toVariant() const
+{
+    switch (kind())
+    {
+        case Kind::Null:
+            return QVariant();
+        case Kind::Bool:
+            return QVariant(*payload<bool>());
+        case Kind::Int:
+            return QVariant(*payload<int>());
+        case Kind::Double:
+            return QVariant(*payload<double>());
+        case Kind::Number:
+            return QVariant::fromValue(value<Number>());
+        case Kind::String:
+        case Kind::ZString:
+            return QVariant(toString());
+        case Kind::Table:
+            return QVariant::fromValue(*payload<Table>());
+    }
+    return QVariant();
+}
+
+Value::Value(const Value &other)
+{
+    copy(other);
+}
+
+Value::Value(Value &&other) noexcept
+{
+    take(other);
+}
+
+Value &Value::operator=(const Value &other)
+{
+    if (this != &other)
+    {
+        destroy();
+        copy(other);
+    }
+    return *this;
+}
+
+Value &Value::operator=(Value &&other) noexcept
+{
+    if (this != &other)
+    {
+        destroy();
+        take(other);
+    }
+    return *this;
+}
+
+Value::~Value()
+{
+    destroy();
+}
+
+void Value::copy(const Value &other)
+{
+    memcpy(m_data, other.m_data, sizeof(m_data));
+    switch (kind())
+    {
+        case Kind::Number:
+            new (payload<QByteArray>()) QByteArray(*other.payload<QByteArray>());
+            break;
+        case Kind::String:
+        case Kind::ZString:
+            if (!isSmall()) new (payload<QString>()) QString(*other.payload<QString>());
+            break;
+        case Kind::Table:
+            new (payload<Table>()) Table(*other.payload<Table>());
+            break;
+        default:
+            break;
+    }
+}
+
+void Value::take(Value &other)
+{
+    memcpy(m_data, other.m_data, sizeof(m_data));
+    switch (kind())
+    {
+        case Kind::Number:
+            new (payload<QByteArray>()) QByteArray(std::move(*other.payload<QByteArray>()));
+            break;
+        case Kind::String:
+        case Kind::ZString:
+            if (!isSmall()) new (payload<QString>()) QString(std::move(*other.payload<QString>()));
+            break;
+        case Kind::Table:
+            new (payload<Table>()) Table(std::move(*other.payload<Table>()));
+            break;
+        default:
+            break;
+    }
+
+    // Leaves other as nil
+    other.destroy();
+    other.m_data[0] = static_cast<unsigned char>(Kind::Null);
+}
+
+void Value::destroy()
+{
+    switch (kind())
+    {
+        case Kind::Number:
+            payload<QByteArray>()->~QByteArray();
+            break;
+        case Kind::String:
+        case Kind::ZString:
+            if (!isSmall()) payload<QString>()->~QString();
+            break;
+        case Kind::Table:
+            payload<Table>()->~Table();
+            break;
+        default:
+            break;
+    }
+}
+
+QVariant::Type Value::type() const
+{
+    switch (kind())
+    {
+        case Kind::Null:
+            return QVariant::Invalid;
+        case Kind::Bool:
+            return QVariant::Bool;
+        case Kind::Int:
+            return QVariant::Int;
+        case Kind::Double:
+            return QVariant::Double;
+        case Kind::String:
+        case Kind::ZString:
+            return QVariant::String;
+        case Kind::Number:
+        case Kind::Table:
+            return QVariant::UserType;
+    }
+    return QVariant::Invalid;
+}
+
+int Value::userType() const
+{
+    switch (kind())
+    {
+        case Kind::Number:
+            return qMetaTypeId<Number>();
+        case Kind::Table:
+            return qMetaTypeId<Table>();
+        default:
+            return static_cast<int>(type());
+    }
+}
+
+bool Value::toBool() const
+{
+    switch (kind())
+    {
+        case Kind::Bool:
+            return *payload<bool>();
+        case Kind::Int:
+            return *payload<int>() != 0;
+        case Kind::Double:
+        case Kind::Number:
+            return toDouble() != 0;
+        case Kind::String:
+        {
+            // As QVariant does
+            const QString s = text();
+            return !(s.isEmpty() || s == QLatin1String("0") || s.compare(QLatin1String("false"), Qt::CaseInsensitive) == 0);
+        }
+        default:
+            return false;
+    }
+}
+
+int Value::toInt() const
+{
+    switch (kind())
+    {
+        case Kind::Bool:
+            return *payload<bool>() ? 1 : 0;
+        case Kind::Int:
+            return *payload<int>();
+        case Kind::Double:
+        case Kind::Number:
+            return qRound(toDouble());
+        case Kind::String:
+            return text().toInt();
+        default:
+            return 0;
+    }
+}
+
+double Value::toDouble() const
+{
+    switch (kind())
+    {
+        case Kind::Bool:
+            return *payload<bool>() ? 1 : 0;
+        case Kind::Int:
+            return *payload<int>();
+        case Kind::Double:
+            return *payload<double>();
+        case Kind::Number:
+            return lexemeValue(*payload<QByteArray>());
+        case Kind::String:
+            return text().toDouble();
+        default:
+            return 0;
+    }
+}
+
+QString Value::toString() const
+{
+    switch (kind())
+    {
+        case Kind::Bool:
+            return *payload<bool>() ? QStringLiteral("true") : QStringLiteral("false");
+        case Kind::Int:
+            return QString::number(*payload<int>());
+        case Kind::Double:
+        {
+            char buffer[formatDoubleSize];
+            return QString::fromLatin1(buffer, formatDouble(*payload<double>(), buffer));
+        }
+        case Kind::Number:
+        case Kind::String:
+            return text();
+        case Kind::ZString:
+            return QStringLiteral("ZSTR:") + text();
+        default:
+            return QString();
+    }
+}
+
+QString Value::text() const
+{
+    if (kind() == Kind::Number) return QString::fromLatin1(*payload<QByteArray>());
+    if (!isString()) return QString();
+
+    if (isSmall()) return QString::fromUtf8(reinterpret_cast<const char *>(m_data + 2), m_data[1]);
+    return *payload<QString>();
+}
+
+template <>
+bool Value::canConvert<Number>() const
+{
+    return kind() == Kind::Number;
+}
+
+template <>
+bool Value::canConvert<QString>() const
+{
+    return kind() != Kind::Null && kind() != Kind::Table;
+}
+
+template <>
+bool Value::canConvert<int>() const
+{
+    return kind() != Kind::Null && kind() != Kind::Table;
+}
+
+template <>
+bool Value::canConvert<double>() const
+{
+    return kind() != Kind::Null && kind() != Kind::Table;
+}
+
+template <>
+bool Value::canConvert<bool>() const
+{
+    return kind() != Kind::Null && kind() != Kind::Table;
+}
+
+template <>
+Table Value::value<Table>() const
+{
+    return kind() == Kind::Table ? *payload<Table>() : Table();
+}
+
+template <>
+Number Value::value<Number>() const
+{
+    if (kind() != Kind::Number) return Number();
+
+    const QByteArray &lexeme = *payload<QByteArray>();
+    return Number(lexemeValue(lexeme), lexeme);
+}
+
+bool Value::operator==(const Value &other) const
+{
+    const Kind a = kind();
+    const Kind b = other.kind();
+
+    const auto isNumber = [](Kind k) { return k == Kind::Int || k == Kind::Double || k == Kind::Number; };
+    if (isNumber(a) && isNumber(b))
+    {
+        if (a == Kind::Int && b == Kind::Int) return *payload<int>() == *other.payload<int>();
+        return toDouble() == other.toDouble();
+    }
+
+    if (a != b) return false;
+
+    switch (a)
+    {
+        case Kind::Null:
+            return true;
+        case Kind::Bool:
+            return *payload<bool>() == *other.payload<bool>();
+        case Kind::String:
+        case Kind::ZString:
+            if (isSmall() && other.isSmall()) return m_data[1] == other.m_data[1] && memcmp(m_data + 2, other.m_data + 2, m_data[1]) == 0;
+            return text() == other.text();
+        case Kind::Table:
+            return *payload<Table>() == *other.payload<Table>();
+        default:
+            return false;
+    }
+}
+
+quint64 Value::contentHash() const
+{
+    const quint64 k = static_cast<quint64>(kind()) << 56;
+    switch (kind())
+    {
+        case Kind::Null:
+            return mixHash(k);
+        case Kind::Bool:
+            return mixHash(k + *payload<bool>());
+        case Kind::Int:
+        case Kind::Double:
+        case Kind::Number:
+        {
+            // All the kinds of number are hashed the same way, as they compare equal
+            double d = toDouble();
+            if (d == 0) d = 0;  // -0 == 0
+            quint64 bits;
+            memcpy(&bits, &d, sizeof(bits));
+            return mixHash(static_cast<quint64>(Kind::Int) << 56 ^ bits);
+        }
+        case Kind::String:
+        case Kind::ZString:
+        {
+            // FNV-1a over the UTF-8, which strings kept in place already are
+            const QByteArray utf8 = isSmall() ? QByteArray() : payload<QString>()->toUtf8();
+            const char *s = isSmall() ? reinterpret_cast<const char *>(m_data + 2) : utf8.constData();
+            const int size = isSmall() ? m_data[1] : utf8.size();
+            quint64 h = 14695981039346656037ULL;
+            for (int i = 0; i < size; i++) h = (h ^ static_cast<unsigned char>(s[i])) * 1099511628211ULL;
+            return mixHash(k ^ h);
+        }
+        case Kind::Table:
+            return payload<Table>()->contentHash();
+    }
+    return 0;
+}
+
+quint64 Value::mixHash(quint64 h)
+{
+    // The splitmix64 finaliser
+    h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+    return h ^ (h >> 31);
+}
+
+};  // namespace LuaParser
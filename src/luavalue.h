@@ -0,0 +1,191 @@
+//  This file is part of LrtEdit.
+//
+// LrtEdit is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// LrtEdit is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LrtEdit.  If not, see <https://www.gnu.org/licenses/>.
+#ifndef LUAVALUE_H
+#define LUAVALUE_H
+
+#include <QByteArray>
+#include <QString>
+#include <QVariant>
+
+#include <algorithm>
+
+namespace LuaParser
+{
+class Number;
+class Table;
+
+/// A value in a Table: nil, a bool, a number, a string or another table.
+///
+/// Takes 16 bytes, with the kind in the first. Strings of up to 14 bytes of UTF-8 (most
+/// of those in a template, e.g. "photo") are kept in place, longer ones in a QString.
+/// A Number only keeps its text, its value being read back from that when asked for.
+///
+/// The accessors follow QVariant's, so code written against a QVariant from a Table
+/// mostly works unchanged. toVariant() and fromVariant() convert at the UI boundary.
+class Value
+{
+   public:
+    enum class Kind : quint8
+    {
+        Null,
+        Bool,
+        Int,
+        Double,
+        Number,  ///< A number which has to be written back as it was read
+        String,
+        ZString,  ///< A string written with the ZSTR prefix
+        Table
+    };
+
+    Value() { m_data[0] = static_cast<unsigned char>(Kind::Null); }
+    Value(bool b);
+    Value(int i);
+    Value(double d);
+    Value(const Number &n);
+    Value(const Table &t);
+
+    /// As when they were QVariants, text starting with "ZSTR:" is a ZSTR
+    Value(const QString &s);
+    Value(const char *s) : Value(QString::fromUtf8(s)) {}
+
+    /// A string straight from the source text, only allocating if it is too long to keep in place
+    static Value fromUtf8(const char *begin, const char *end, bool zstr = false);
+
+    /// Exactly the text given, however it starts
+    static Value fromString(const QString &s, bool zstr = false);
+
+    static Value fromVariant(const QVariant &v);
+    QVariant toVariant() const;
+
+    Value(const Value &other);
+    Value(Value &&other) noexcept;
+    Value &operator=(const Value &other);
+    Value &operator=(Value &&other) noexcept;
+    ~Value();
+
+    Kind kind() const { return static_cast<Kind>(m_data[0]); }
+    bool isNull() const { return kind() == Kind::Null; }
+    bool isValid() const { return kind() != Kind::Null; }
+
+    /// The nearest QVariant types, e.g. QVariant::String for both kinds of string
+    QVariant::Type type() const;
+    int userType() const;
+
+    bool toBool() const;
+    int toInt() const;
+    double toDouble() const;
+
+    /// A ZSTR comes back with its "ZSTR:" prefix, as it used to
+    QString toString() const;
+
+    /// The text of a string or ZSTR, or the original text of a number
+    QString text() const;
+
+    /// The table held, or nullptr if this is not a table.
+    /// Changing it through the non-const version changes this value.
+    const Table *table() const { return kind() == Kind::Table ? payload<Table>() : nullptr; }
+    Table *table() { return kind() == Kind::Table ? payload<Table>() : nullptr; }
+
+    template <typename T>
+    bool canConvert() const;
+    template <typename T>
+    T value() const;
+
+    /// Tables are compared by contents, numbers by value (whichever kind they are)
+    bool operator==(const Value &other) const;
+    bool operator!=(const Value &other) const { return !(*this == other); }
+
+    /// A 64 bit hash of the contents, the same for any values which compare equal.
+    /// A table's is worked out once, and kept until it is changed.
+    quint64 contentHash() const;
+
+    /// Scramble the bits of a hash, so that hashes can be combined by adding them
+    static quint64 mixHash(quint64 h);
+
+   private:
+    // Byte 0 is the kind and byte 1 the length of a string kept in place (or longString).
+    // A string in place follows from byte 2 to the end, anything else is at byte 8.
+    // With Qt 5's single pointer QString that makes 16 bytes in all.
+    static constexpr size_t payloadSize = std::max(sizeof(QString), sizeof(QByteArray));
+    static constexpr int smallSize = static_cast<int>(6 + payloadSize);
+    static const unsigned char longString = 0xff;
+
+    template <typename T>
+    T *payload()
+    {
+        return reinterpret_cast<T *>(m_data + 8);
+    }
+    template <typename T>
+    const T *payload() const
+    {
+        return reinterpret_cast<const T *>(m_data + 8);
+    }
+
+    bool isString() const { return kind() == Kind::String || kind() == Kind::ZString; }
+    bool isSmall() const { return m_data[1] != longString; }
+    void setString(Kind kind, const QString &s);
+    void copy(const Value &other);
+    void take(Value &other);
+    void destroy();
+
+    alignas(8) unsigned char m_data[8 + payloadSize];
+};
+
+template <>
+inline bool Value::canConvert<Table>() const
+{
+    return kind() == Kind::Table;
+}
+template <>
+bool Value::canConvert<Number>() const;
+template <>
+bool Value::canConvert<QString>() const;
+template <>
+bool Value::canConvert<int>() const;
+template <>
+bool Value::canConvert<double>() const;
+template <>
+bool Value::canConvert<bool>() const;
+
+template <>
+Table Value::value<Table>() const;
+template <>
+Number Value::value<Number>() const;
+template <>
+inline QString Value::value<QString>() const
+{
+    return toString();
+}
+template <>
+inline int Value::value<int>() const
+{
+    return toInt();
+}
+template <>
+inline double Value::value<double>() const
+{
+    return toDouble();
+}
+template <>
+inline bool Value::value<bool>() const
+{
+    return toBool();
+}
+
+};  // namespace LuaParser
+
+Q_DECLARE_TYPEINFO(LuaParser::Value, Q_MOVABLE_TYPE);
+
+#endif // LUAVALUE_H
@@ -16,8 +16,11 @@
 #include "ui_mainwindow.h"
 
 #include "layoutpage.h"
+#include "layoutschema.h"
+#include "luadiff.h"
 #include "luagenerator.h"
 #include "luaparser.h"
+#include "luapool.h"
 #include "pageeditor.h"
 
 #include <QDebug>
@@ -25,6 +28,7 @@
 #include <QFileDialog>
 #include <QFileInfo>
 #include <QMessageBox>
+#include <QSet>
 
 // From kayleeFrye_onDeck at
 // https://stackoverflow.com/questions/2536524/copy-directory-using-qt
@@ -83,6 +87,9 @@ MainWindow::MainWindow(QWidget *parent) : QMainWindow(parent), ui(new Ui::MainWi
     ui->pagesPreview->setIconSize(QSize(100, 100));
     ui->pagesPreview->setResizeMode(QListWidget::Adjust);
 
+    ui->actionUndo->setShortcut(QKeySequence::Undo);
+    ui->actionRedo->setShortcut(QKeySequence::Redo);
+
     determineRoots();
     // setRoot("C:\\Program Files\\Adobe\\Adobe Lightroom\\Templates\\Layout Templates");
 }
@@ -138,7 +145,7 @@ void MainWindow::loadTemplateSizes(const QString &path)
     qInfo() << "Reading template sizes from" << templateSizesPath;
 
     using namespace LuaParser;
-    const NamedVariant nv = readLuaStruct(templateSizesPath);
+    const NamedVariant nv = m_snapshots.read(templateSizesPath);
 
     // Convert back to text for viewing
     ui->textEdit->setText(LuaGenerator::Generate(nv));
@@ -197,9 +204,14 @@ void MainWindow::loadTemplate(const QString &specificTemplatePages)
     qInfo() << "Loading template from" << specificTemplatePages;
     m_currentTemplatePath = specificTemplatePages;
 
-    using namespace LuaParser;
-    const NamedVariant nv = readLuaStruct(specificTemplatePages);
-    m_currentTemplate = nv.value().value<Table>();
+    // Every page is built below, so take the whole tree from a snapshot when there is one.
+    // Pages repeat the same hints and text styles over and over, so each of those is kept once.
+    LuaParser::TablePool pool;
+    const LuaParser::NamedVariant nv = pool.intern(m_snapshots.read(specificTemplatePages));
+    m_currentTemplate = nv.value().value<LuaParser::Table>();
+    m_history.reset(m_currentTemplate);
+    updateUndoActions();
+    if (m_currentTemplate.atoms().isEmpty()) return;
 
     // Convert back to text for viewing
     ui->textEdit->setText(LuaGenerator::Generate(nv));
@@ -208,54 +220,14 @@ void MainWindow::loadTemplate(const QString &specificTemplatePages)
     const QString groupTitle = m_currentTemplate.getString("hints/bookTitle");
     qDebug() << "book title is" << groupTitle;
 
-    auto pages = m_currentTemplate.getAttr("pages").value<LuaParser::Table>();
-    qDebug() << pages.hash() << "pages";
+    const int pageCount = m_currentTemplate.getSequenceSize("pages");
+    qDebug() << pageCount << "pages";
 
     m_layoutPages.clear();
-
-    // pages/#/title
-    // pages/#/pageWidth
-    // pages/#/pageHeight
-    // pages/#/previewName
-    // pages/#/1/children/#/hints/placeholderType = "photo"
-    // pages/#/1/children/#/hints/photoIndex
-    // pages/#/1/children/#/transform/x
-    // pages/#/1/children/#/transform/y
-    // pages/#/1/children/#/transform/width
-    // pages/#/1/children/#/transform/height
-    for (int i = 1; i <= pages.hash(); i++)
+    for (int i = 1; i <= pageCount; i++)
     {
-        auto page = pages[i].value<LuaParser::Table>();
+        const LayoutPage lp = LayoutSchema::readPage(m_currentTemplate.getTable(LuaParser::Table::Path{"pages", i}));
 
-        LayoutPage lp;
-        lp.name = page.getString("name");
-        lp.previewName = page.getString("previewName");
-        lp.size.setWidth(page.getInt("pageWidth"));
-        lp.size.setHeight(page.getInt("pageHeight"));
-
-        // qDebug() << page.getInt("pageWidth") << page.getInt("pageHeight") << page.getString("previewName");
-        auto elements = page.getAttr("1/children").value<LuaParser::Table>();
-        for (int e = 1; e <= elements.hash(); e++)
-        {
-            LayoutElement le;
-            le.pos.setX(elements.getDouble(QString::number(e) + "/transform/x"));
-            le.pos.setY(elements.getDouble(QString::number(e) + "/transform/y"));
-            le.pos.setWidth(elements.getDouble(QString::number(e) + "/transform/width"));
-            le.pos.setHeight(elements.getDouble(QString::number(e) + "/transform/height"));
-            // placeholderType = "photo",
-            if (elements.getString(QString::number(e) + "/placeholderType") == "photo")
-            {
-                le.index = elements.getInt(QString::number(e) + "/hints/photoIndex");
-                lp.photos.resize(le.index);
-                lp.photos[le.index - 1] = le;
-            }
-            else if (elements.getString(QString::number(e) + "/placeholderType") == "text")
-            {
-                le.index = elements.getInt(QString::number(e) + "/hints/textIndex");
-                lp.text.resize(std::max(lp.text.size(), le.index));  // NB: max required as order is not guaranteed
-                lp.text[le.index - 1] = le;
-            }
-        }
         const auto br = lp.boundingBox();
         qDebug() << "Bounding box is" << br;
         qDebug() << "Margins: top=" << br.top() << ", bottom=" << (lp.size.height() - br.bottom())
@@ -377,6 +349,21 @@ void MainWindow::on_pagesPreview_itemDoubleClicked(QListWidgetItem *item)
     {
       m_layoutPages[index] = lp;
 
+      // Keep the template up to date, so that the edit can be undone. A page accepted
+      // without changes leaves the template, and so the history, as it was.
+      const LuaParser::Table::Path path{"pages", index + 1};
+      const LuaParser::Value *found = m_currentTemplate.find(path);
+      if (found != nullptr && found->table() != nullptr)
+      {
+        LuaParser::Table page = *found->table();
+        if (LayoutSchema::writePage(lp, page) > 0)
+        {
+          m_currentTemplate.setAttr(path, page);
+          m_history.push(m_currentTemplate);
+          updateUndoActions();
+        }
+      }
+
       // Update the icon / preview
       const QImage image = lp.createImage();
       item->setIcon(QIcon(QPixmap::fromImage(image)));
@@ -386,30 +373,15 @@ void MainWindow::on_pagesPreview_itemDoubleClicked(QListWidgetItem *item)
 
 void MainWindow::on_actionSave_triggered()
 {
-    // Update / generate the stored file with the current layout
-    auto &table = m_currentTemplate;
-    int page = 1;
+    if (m_currentTemplate.atoms().isEmpty()) return;
+
+    // Edited pages were written to the template as they were accepted, so only the previews need making
     for (auto const &lp : m_layoutPages)
     {
-        int element = 1;
-        for (auto const &p : lp.photos)
-        {
-            const QString transform = QString("pages/%1/1/children/%2/transform").arg(page).arg(element);
-
-            table.setAttr(transform + "/x", p.pos.x());
-            table.setAttr(transform + "/y", p.pos.y());
-            table.setAttr(transform + "/width", p.pos.width());
-            table.setAttr(transform + "/height", p.pos.height());
-
-            element++;
-        }
-
         const QImage previewImage =
             lp.createImage().scaled(QSize(100, 100), Qt::KeepAspectRatioByExpanding, Qt::SmoothTransformation);
         const QString previewPath = QFileInfo(m_currentTemplatePath).dir().filePath(lp.previewName);
         previewImage.save(previewPath);
-
-        page++;
     }
 
     // Write the layout to a file
@@ -432,6 +404,47 @@ void MainWindow::on_actionSave_triggered()
     }
 }
 
+void MainWindow::on_actionUndo_triggered()
+{
+    if (m_history.canUndo()) restoreTemplate(m_history.undo());
+}
+
+void MainWindow::on_actionRedo_triggered()
+{
+    if (m_history.canRedo()) restoreTemplate(m_history.redo());
+}
+
+void MainWindow::restoreTemplate(const LuaParser::Table &version)
+{
+    // Versions share the pages which were not edited, so finding the ones which were is quick
+    static const LuaParser::Table::Path::Segment pages("pages");
+    QSet<int> changed;
+    for (const LuaParser::Change &change : LuaParser::diff(m_currentTemplate, version))
+    {
+        if (change.path.size() > 1 && change.path.at(0) == pages && change.path.at(1).isIndex()) changed.insert(change.path.at(1).index());
+    }
+
+    m_currentTemplate = version;
+
+    // The current template's previews are the last ones in the list
+    const int firstItem = ui->pagesPreview->count() - m_layoutPages.size();
+    for (const int page : changed)
+    {
+        if (page > m_layoutPages.size()) continue;
+
+        const LayoutPage lp = LayoutSchema::readPage(m_currentTemplate.getTable(LuaParser::Table::Path{"pages", page}));
+        m_layoutPages[page - 1] = lp;
+        ui->pagesPreview->item(firstItem + page - 1)->setIcon(QIcon(QPixmap::fromImage(lp.createImage())));
+    }
+    updateUndoActions();
+}
+
+void MainWindow::updateUndoActions()
+{
+    ui->actionUndo->setEnabled(m_history.canUndo());
+    ui->actionRedo->setEnabled(m_history.canRedo());
+}
+
 void MainWindow::on_actionBackup_triggered() {
   const QString backupDir = QFileDialog::getExistingDirectory(this, tr("Select a directory to backup these custom pages"), m_backupRoot,
                                                               QFileDialog::ShowDirsOnly | QFileDialog::DontResolveSymlinks);
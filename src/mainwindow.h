@@ -15,7 +15,9 @@
 #ifndef MAINWINDOW_H
 #define MAINWINDOW_H
 
+#include "luahistory.h"
 #include "luaparser.h"
+#include "luasnapshot.h"
 
 #include "layoutpage.h"
 
@@ -62,6 +64,9 @@ class MainWindow : public QMainWindow
 
     void on_actionSave_triggered();
 
+    void on_actionUndo_triggered();
+    void on_actionRedo_triggered();
+
     /// Copy everything from C:\Users\XXXXXX\AppData\Roaming\Adobe\Lightroom\Layout Templates\12x12-blurb to a new
     /// directory
     void on_actionBackup_triggered();
@@ -78,11 +83,21 @@ class MainWindow : public QMainWindow
     /// The top-level user app data directory, e.g. %APPDATA%\Adobe\Lightroom\Layout Templates
     QString m_userRoot;
 
+    /// Parsed lua files from previous runs
+    LuaParser::SnapshotCache m_snapshots;
+
     LuaParser::Table m_templateSizes;
 
     QString m_currentTemplatePath;
     LuaParser::Table m_currentTemplate;
     QList<LayoutPage> m_layoutPages;
+
+    /// Versions of m_currentTemplate, one for each page edit since it was loaded
+    LuaParser::TableHistory m_history;
+
+    /// Make version the current template, reading back the pages which differ
+    void restoreTemplate(const LuaParser::Table &version);
+    void updateUndoActions();
 };
 
 #endif // MAINWINDOW_H
@@ -29,9 +29,12 @@ const int captureWidth = 42;
 }  // namespace
 
 PageEditor::PageEditor(QWidget *parent)
-    : QDialog(parent), ui(new Ui::PageEditor), m_layoutPage(nullptr), m_layoutPageModel(nullptr)
+    : QDialog(parent), ui(new Ui::PageEditor), m_layoutPage(nullptr), m_layoutPageModel(nullptr), m_restoring(false)
 {
   ui->setupUi(this);
+
+  ui->undoBtn->setShortcut(QKeySequence::Undo);
+  ui->redoBtn->setShortcut(QKeySequence::Redo);
 }
 
 PageEditor::~PageEditor()
@@ -63,6 +66,10 @@ void PageEditor::setPreviewImage(const QIcon &icon)
 void PageEditor::setLayoutPage(LayoutPage *lp)
 {
   m_layoutPage = lp;
+  m_previous = lp ? *lp : LayoutPage();
+  m_undo.clear();
+  m_redo.clear();
+  updateUndoButtons();
 
   if (m_layoutPageModel)
     delete m_layoutPageModel;
@@ -73,6 +80,7 @@ void PageEditor::setLayoutPage(LayoutPage *lp)
   refreshPreviewImage();
 
   connect(m_layoutPageModel, &LayoutPageModel::dataChanged, this, &PageEditor::refreshPreviewImage);
+  connect(m_layoutPageModel, &LayoutPageModel::dataChanged, this, &PageEditor::pageEdited);
 }
 
 void PageEditor::on_snapMarginsBtn_clicked()
@@ -101,3 +109,50 @@ void PageEditor::on_snapToGridBtn_clicked()
   m_layoutPage->snapToGrid(grid);
   m_layoutPageModel->invalidate();
 }
+
+void PageEditor::on_undoBtn_clicked()
+{
+  if (!m_layoutPage || m_undo.isEmpty())
+    return;
+
+  m_redo.append(*m_layoutPage);
+  restore(m_undo.takeLast());
+}
+
+void PageEditor::on_redoBtn_clicked()
+{
+  if (!m_layoutPage || m_redo.isEmpty())
+    return;
+
+  m_undo.append(*m_layoutPage);
+  restore(m_redo.takeLast());
+}
+
+void PageEditor::pageEdited()
+{
+  if (!m_layoutPage || m_restoring)
+    return;
+
+  m_undo.append(m_previous);
+  m_redo.clear();
+  m_previous = *m_layoutPage;
+  updateUndoButtons();
+}
+
+void PageEditor::restore(const LayoutPage &lp)
+{
+  *m_layoutPage = lp;
+  m_previous = lp;
+
+  m_restoring = true;
+  m_layoutPageModel->invalidate();
+  m_restoring = false;
+
+  updateUndoButtons();
+}
+
+void PageEditor::updateUndoButtons()
+{
+  ui->undoBtn->setEnabled(!m_undo.isEmpty());
+  ui->redoBtn->setEnabled(!m_redo.isEmpty());
+}
@@ -15,10 +15,12 @@
 #ifndef PAGEEDITOR_H
 #define PAGEEDITOR_H
 
+#include "layoutpage.h"
+
 #include <QDialog>
 #include <QIcon>
+#include <QVector>
 
-class LayoutPage;
 class LayoutPageModel;
 
 namespace Ui {
@@ -47,10 +49,26 @@ class PageEditor : public QDialog
 
     void on_snapToGridBtn_clicked();
 
+    void on_undoBtn_clicked();
+
+    void on_redoBtn_clicked();
+
+    /// Keep the page as it was before each change, for undo
+    void pageEdited();
+
    private:
+    void restore(const LayoutPage &lp);
+    void updateUndoButtons();
+
     Ui::PageEditor *ui;
     LayoutPage *m_layoutPage;
     LayoutPageModel *m_layoutPageModel;
+
+    // The page's elements are implicitly shared, so these versions are cheap to keep
+    LayoutPage m_previous;
+    QVector<LayoutPage> m_undo;
+    QVector<LayoutPage> m_redo;
+    bool m_restoring;
 };
 
 #endif // PAGEEDITOR_H
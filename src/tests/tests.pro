@@ -1,19 +1,42 @@
-QT += testlib
+QT += testlib concurrent
 QT -= gui
 
-CONFIG += qt console warn_on depend_includepath testcase
+CONFIG += qt console warn_on depend_includepath testcase c++17
 CONFIG -= app_bundle
 
 TEMPLATE = app
 
 SOURCES +=  tst_testluaparser.cpp \
+    ../luaarena.cpp \
+    ../luaatom.cpp \
+    ../luadiff.cpp \
     ../luagenerator.cpp \
+    ../luahistory.cpp \
+    ../lualexer.cpp \
+    ../luanumber.cpp \
     ../luaparser.cpp \
-    ../luatable.cpp
+    ../luapool.cpp \
+    ../luaquery.cpp \
+    ../luascanner.cpp \
+    ../luasnapshot.cpp \
+    ../luatable.cpp \
+    ../luavalue.cpp
 
 HEADERS += \
+    ../luaarena.h \
+    ../luaatom.h \
+    ../luadiff.h \
     ../luagenerator.h \
+    ../luahistory.h \
+    ../lualexer.h \
+    ../luanumber.h \
     ../luaparser.h \
-    ../luatable.h
+    ../luapool.h \
+    ../luaquery.h \
+    ../luaschema.h \
+    ../luascanner.h \
+    ../luasnapshot.h \
+    ../luatable.h \
+    ../luavalue.h
 
 INCLUDEPATH += ..
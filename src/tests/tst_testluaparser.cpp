@@ -14,9 +14,21 @@
 // along with LrtEdit.  If not, see <https://www.gnu.org/licenses/>.
 #include <QtTest>
 
+#include <thread>
+
 // add necessary includes here
+#include "luaarena.h"
+#include "luadiff.h"
 #include "luagenerator.h"
+#include "luahistory.h"
+#include "lualexer.h"
+#include "luanumber.h"
 #include "luaparser.h"
+#include "luapool.h"
+#include "luaquery.h"
+#include "luaschema.h"
+#include "luascanner.h"
+#include "luasnapshot.h"
 
 class TestLuaParser : public QObject
 {
@@ -35,16 +47,84 @@ class TestLuaParser : public QObject
     void test_case2b();
     void test_case2c();
     void test_setAttr();
+    void test_sharedTables();
+    void test_paths();
+    void test_ref();
+    void test_edits();
+    void test_diff();
+    void test_contentHash();
+    void test_pool();
+    void test_query();
+    void test_schema();
+    void test_history();
+    void test_find();
+    void test_forEach();
+    void test_values();
     void test_file();
+    void test_readModes();
+    void test_events();
+    void test_arenaDocument();
+    void test_parallel();
     void test_number_list();
+    void test_numberLexemes();
+    void test_atoms();
+    void test_luaSyntax();
+    void test_snapshots();
+    void test_lexer();
+    void test_structuralIndex();
 
     // TODO: generator tests should be moved out to a separate test
     void test_generator();
     void test_generator_mix();
+    void test_keyOrder();
+
+    void benchmark_parse();
+    void benchmark_parseParallel();
+    void benchmark_loadUnload();
+    void benchmark_loadUnloadArena();
+    void benchmark_generate();
+    void benchmark_readSnapshot();
+    void benchmark_getAttr();
+    void benchmark_getAttrPath();
+    void benchmark_setAttr();
+    void benchmark_applyEdits();
+    void benchmark_diff();
+    void benchmark_matchPages();
+    void benchmark_intern();
+    void benchmark_query();
+    void benchmark_probe();
+    void benchmark_walk();
+    void benchmark_scanLexer();
+    void benchmark_scanScalar();
+    void benchmark_scanSimd();
 };
 
 using namespace LuaParser;
 
+// Something resembling a large templatePages.lua
+static QString syntheticTemplate(int pages)
+{
+    QString s = "pages = {\n  hints = {\n    bookTitle = \"Custom\",\n  },\n  pages = {\n";
+    for (int p = 1; p <= pages; p++)
+    {
+        s += "    {\n      {\n        children = {\n";
+        for (int c = 1; c <= 6; c++)
+        {
+            s += QString("          {\n"
+                         "            hints = {\n              photoIndex = %1,\n            },\n"
+                         "            placeholderType = \"photo\",\n"
+                         "            transform = {\n              angle = 0,\n              height = 435.5,\n"
+                         "              width = 580.09771728516,\n              x = %2,\n              y = 348,\n"
+                         "            },\n          },\n")
+                     .arg(c)
+                     .arg(p * 10 + c);
+        }
+        s += QString("        },\n      },\n      name = \"page%1\",\n      previewName = \"page%1.jpg\",\n    },\n").arg(p);
+    }
+    s += "  },\n}\n";
+    return s;
+}
+
 TestLuaParser::TestLuaParser()
 {
 
@@ -83,8 +163,6 @@ void TestLuaParser::test_list()
 
 void TestLuaParser::test_number_list()
 {
-    QSKIP("Lists of numbers don't work, but not strictly needed for LRTedit");
-
     const NamedVariant nv = parseLuaStruct("testing = {1, 2, 3, 4}");
 
     // qDebug() << LuaGenerator::Generate(nv);
@@ -96,6 +174,316 @@ void TestLuaParser::test_number_list()
     QCOMPARE(t.keys().size(), 0);
 }
 
+void TestLuaParser::test_lexer()
+{
+    const QByteArray s("t = {x=-10, \"a b\", true}");
+    Lexer lexer(s.constData(), s.constData() + s.size());
+
+    const Token::Type expected[] = {Token::Identifier, Token::Equals, Token::OpenBrace, Token::Identifier,
+                                    Token::Equals,     Token::Number, Token::Comma,     Token::String,
+                                    Token::Comma,      Token::Identifier, Token::CloseBrace, Token::EndOfInput};
+    for (const auto type : expected)
+    {
+        const Token token = lexer.next();
+        QCOMPARE(token.type, type);
+
+        // Tokens are slices of the source, not copies
+        QVERIFY(token.text.begin >= s.constData() && token.text.end <= s.constData() + s.size());
+        if (token.type == Token::String) QCOMPARE(token.text.toString(), QString("a b"));
+        if (token.type == Token::Number) QCOMPARE(token.text.toString(), QString("-10"));
+    }
+}
+
+void TestLuaParser::test_numberLexemes()
+{
+    const QString s =
+        ("n = {\n"
+         "    2,\n"
+         "    -7,\n"
+         "    580.09771728516,\n"
+         "    1.50,\n"
+         "    007,\n"
+         "    -0,\n"
+         "    0.1,\n"
+         "    3000000000,\n"
+         "    0.333333333333333333,\n"
+         "}");
+
+    const NamedVariant nv = parseLuaStruct(s);
+    const Table t = nv.value().value<Table>();
+    QCOMPARE(t.hash(), 9);
+
+    // Plain values where writing them gives back the same text
+    QCOMPARE(t[1].type(), QVariant::Int);
+    QCOMPARE(t[2].type(), QVariant::Int);
+    QCOMPARE(t[3].type(), QVariant::Double);
+    QCOMPARE(t[6].type(), QVariant::Double);
+    QCOMPARE(t[7].type(), QVariant::Double);
+    QCOMPARE(t[8].type(), QVariant::Double);
+
+    // The rest keep their text, but still work as numbers
+    QCOMPARE(t[4].userType(), qMetaTypeId<Number>());
+    QCOMPARE(t[4].toDouble(), 1.5);
+    QCOMPARE(t[5].toInt(), 7);
+    QCOMPARE(t[5].value<Number>().lexeme(), QByteArray("007"));
+    QCOMPARE(t[9].toDouble(), 1.0 / 3.0);
+
+    // Every number is written back exactly as it was read
+    const QStringList a = s.split('\n');
+    const QStringList b = LuaGenerator::Generate(nv).split('\n');
+    QCOMPARE(b.size(), a.size());
+    for (int i = 0; i < a.size(); i++) QCOMPARE(b[i].trimmed(), a[i].trimmed());
+
+    // A changed value is written as a plain double
+    Table changed = t;
+    changed[4] = 2.25;
+    QVERIFY(LuaGenerator::Generate(changed).contains("2.25,"));
+}
+
+void TestLuaParser::test_atoms()
+{
+    const Atom a("transform");
+    const char text[] = "transform";
+    QCOMPARE(Atom::fromUtf8(text, text + 9), a);
+    QCOMPARE(Atom::find("transform"), a);
+    QCOMPARE(a.toString(), QString("transform"));
+    QVERIFY(Atom("transforms") != a);
+    QVERIFY(Atom::find("neverUsedAsAKey").isNull());
+
+    // Other threads find the same atoms, including ones they have not seen before
+    Atom fromThread, addedByThread;
+    std::thread([&] {
+        fromThread = Atom::fromUtf8(text, text + 9);
+        addedByThread = Atom("addedOnAnotherThread");
+    }).join();
+    QCOMPARE(fromThread, a);
+    QCOMPARE(Atom::find("addedOnAnotherThread"), addedByThread);
+
+    // Pages repeat the same keys, so parsing more of them adds no atoms
+    const NamedVariant nv = parseLuaStruct(syntheticTemplate(5));
+    const int count = Atom::count();
+    parseLuaStruct(syntheticTemplate(20));
+    QCOMPARE(Atom::count(), count);
+
+    // Keys are listed in the order they were added, whatever order they were interned in
+    Table t;
+    t["zebra"] = 1;
+    t["apple"] = 2;
+    t[Atom("mango")] = 3;
+    QCOMPARE(t.keys(), QList<QString>() << "zebra"
+                                        << "apple"
+                                        << "mango");
+    QCOMPARE(t["mango"].toInt(), 3);
+    QCOMPARE(t[Atom("apple")].toInt(), 2);
+    QVERIFY_EXCEPTION_THROWN(static_cast<const Table &>(t)["neverUsedAsAKey"], QException);
+}
+
+void TestLuaParser::test_luaSyntax()
+{
+    const QString s =
+        ("s = {\n"
+         "  --[[ a block comment\n"
+         "       over several lines, with a brace } ]]\n"
+         "  a = \"say \\\"hi\\\"\\tthen\\\\go\\65\\x42\\u{e9}\", -- trailing comment\n"
+         "  b = 'single \"quotes\"';\n"
+         "  c = [[\nlong\n\"string\" with \\ ]],\n"
+         "  d = [==[ contains ]] and ]=] ]==],\n"
+         "  [\"e f\"] = 0x1F,\n"
+         "  [1] = 1e3,\n"
+         "  [2] = --[==[ comment ]==] -2,\n"
+         "  ZSTR 'zed',\n"
+         "}");
+
+    const NamedVariant nv = parseLuaStruct(s);
+    QCOMPARE(nv.name(), QString("s"));
+
+    const Table t = nv.value().value<Table>();
+    QCOMPARE(t.hash(), 3);
+    QCOMPARE(t.keys().size(), 5);
+    QCOMPARE(t.getString("a"), QString::fromUtf8("say \"hi\"\tthen\\goAB\xc3\xa9"));
+    QCOMPARE(t.getString("b"), QString("single \"quotes\""));
+    QCOMPARE(t.getString("c"), QString("long\n\"string\" with \\ "));
+    QCOMPARE(t.getString("d"), QString(" contains ]] and ]=] "));
+    QCOMPARE(t["e f"].toInt(), 31);
+    QCOMPARE(t[1].toDouble(), 1000.0);
+    QCOMPARE(t[2].toInt(), -2);
+    QCOMPARE(t[3].toString(), QString("ZSTR:zed"));
+
+    // Written back as something which reads the same
+    const NamedVariant again = parseLuaStruct(LuaGenerator::Generate(nv));
+    QCOMPARE(LuaGenerator::Generate(again), LuaGenerator::Generate(nv));
+    QCOMPARE(again.value().value<Table>().getString("a"), t.getString("a"));
+    QVERIFY(LuaGenerator::Generate(nv).contains("[\"e f\"] = 0x1F,"));
+
+    // Keys can have escapes too, and lua's reserved words are written back as ["keys"]
+    const NamedVariant keys = parseLuaStruct("s = { [\"a\\\"b\"] = 1, [\"end\"] = 2, [\"nil\"] = 3, ending = 4 }");
+    QCOMPARE(keys.value().value<Table>().getInt("a\"b"), 1);
+    const QString written = LuaGenerator::Generate(keys);
+    QVERIFY(written.contains("[\"a\\\"b\"] = 1,"));
+    QVERIFY(written.contains("[\"end\"] = 2,"));
+    QVERIFY(written.contains("[\"nil\"] = 3,"));
+    QVERIFY(written.contains(" ending = 4,"));
+    QCOMPARE(LuaGenerator::Generate(parseLuaStruct(written)), written);
+
+    // Skipping tables for other threads copes with all of it too
+    const QByteArray nested = ("n = { " + s.mid(4) + ", { " + s.mid(4) + " } }").toUtf8();
+    const NamedVariant parallel = parseLuaStruct(nested.constData(), nested.constData() + nested.size(), ThreadMode::Parallel);
+    const NamedVariant serial = parseLuaStruct(nested.constData(), nested.constData() + nested.size(), ThreadMode::Serial);
+    QCOMPARE(parallel.value().value<Table>().getString("2/1/d"), t.getString("d"));
+    QCOMPARE(LuaGenerator::Generate(parallel), LuaGenerator::Generate(serial));
+
+    // Any number lua would read is read, whatever way it is written
+    const Table numbers = parseLuaStruct("s = { .5, 5., 1E+05, -0x10, 2e-3 }").value().value<Table>();
+    QCOMPARE(numbers.hash(), 5);
+    QCOMPARE(numbers[1].toDouble(), 0.5);
+    QCOMPARE(numbers[2].toDouble(), 5.0);
+    QCOMPARE(numbers[3].toDouble(), 1e5);
+    QCOMPARE(numbers[4].toInt(), -16);
+    QCOMPARE(numbers[5].toDouble(), 2e-3);
+
+    // Anything else is an error, rather than a nil which would be written back as something else
+    for (const char *bad : {"12abc", "-", "1.2.3", "1e999", "0xFFFFFFFFFFFFFFFF", "0x1p4", "1e", "0x", ".", "1.5x"})
+    {
+        const QByteArray text = QByteArray("s = { 1, { ") + bad + " } }";
+        QVERIFY2(parseLuaStruct(QString::fromUtf8(text)).name().isEmpty(), bad);
+        QVERIFY2(parseLuaStruct(text.constData(), text.constData() + text.size(), ThreadMode::Parallel).name().isEmpty(), bad);
+    }
+
+    // Only the next list position can be used as a number key
+    QVERIFY(parseLuaStruct("s = { [2] = 1 }").name().isEmpty());
+    QVERIFY(parseLuaStruct("s = { a = \"unfinished }").name().isEmpty());
+    QVERIFY(parseLuaStruct("s = { --[[ unfinished }").name().isEmpty());
+}
+
+void TestLuaParser::test_snapshots()
+{
+    const QString s =
+        ("s = {\n"
+         "  { 1, -2, 3.25, 1.50, 0x10, true, false, \"text \\\"quoted\\\"\", ZSTR \"$$$/z\", {}, \"ZSTR:plain\" },\n"
+         "  [\"odd key\"] = { x = 580.09771728516, y = -1e300 },\n"
+         "  name = \"n\",\n"
+         "}");
+    const NamedVariant nv = parseLuaStruct(s);
+
+    // Everything survives a round trip
+    SnapshotSource source;
+    source.size = 123;
+    source.modified = 1560270545000;
+    source.hash = "0123456789abcdef";
+    const QByteArray snapshot = writeSnapshot(nv, source);
+
+    SnapshotSource header;
+    QVERIFY(readSnapshotSource(snapshot.constData(), snapshot.constData() + snapshot.size(), header));
+    QCOMPARE(header.size, source.size);
+    QCOMPARE(header.modified, source.modified);
+    QCOMPARE(header.hash, source.hash);
+
+    NamedVariant back;
+    QVERIFY(readSnapshot(snapshot.constData(), snapshot.constData() + snapshot.size(), back));
+    QCOMPARE(back.name(), nv.name());
+    QCOMPARE(LuaGenerator::Generate(back), LuaGenerator::Generate(nv));
+    QCOMPARE(back.value().value<Table>().getAttr("1/4").userType(), qMetaTypeId<Number>());
+    QCOMPARE(back.value().value<Table>().getAttr("1/9").kind(), Value::Kind::ZString);
+    QCOMPARE(back.value().value<Table>().getAttr("1/11").kind(), Value::Kind::String);
+
+    // Any truncation is noticed rather than read past
+    for (int size = 0; size < snapshot.size(); size++)
+        QVERIFY(!readSnapshot(snapshot.constData(), snapshot.constData() + size, back));
+
+    // The cache only parses on a miss
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const QString path = dir.filePath("templatePages.lua");
+    const QByteArray text = syntheticTemplate(10).toUtf8();
+    {
+        QFile f(path);
+        QVERIFY(f.open(QIODevice::WriteOnly));
+        f.write(text);
+    }
+
+    SnapshotCache cache(dir.filePath("cache"));
+    const QString expected = LuaGenerator::Generate(cache.read(path));
+    QCOMPARE(cache.misses(), 1);
+    QVERIFY(QFile::exists(cache.snapshotPath(path)));
+
+    QCOMPARE(LuaGenerator::Generate(cache.read(path)), expected);
+    QCOMPARE(cache.hits(), 1);
+
+    // Rewriting the same text only changes the time, so the contents match the snapshot
+    QTest::qSleep(20);
+    {
+        QFile f(path);
+        QVERIFY(f.open(QIODevice::WriteOnly));
+        f.write(text);
+    }
+    QCOMPARE(LuaGenerator::Generate(cache.read(path)), expected);
+    QCOMPARE(cache.hits(), 2);
+    QCOMPARE(cache.misses(), 1);
+
+    // A changed file is parsed again
+    {
+        QFile f(path);
+        QVERIFY(f.open(QIODevice::WriteOnly));
+        f.write(syntheticTemplate(11).toUtf8());
+    }
+    QCOMPARE(cache.read(path).value().value<Table>().getSequenceSize("pages"), 11);
+    QCOMPARE(cache.misses(), 2);
+
+    // As is one with an unreadable snapshot
+    {
+        QFile f(cache.snapshotPath(path));
+        QVERIFY(f.open(QIODevice::WriteOnly));
+        f.write(snapshot.left(snapshot.size() / 2));
+    }
+    QCOMPARE(cache.read(path).value().value<Table>().getSequenceSize("pages"), 11);
+    QCOMPARE(cache.misses(), 3);
+    QCOMPARE(cache.hits(), 2);
+}
+
+// Where each token starts, according to the lexer
+static QVector<quint32> tokenOffsets(const QByteArray &s)
+{
+    QVector<quint32> offsets;
+    Lexer lexer(s.constData(), s.constData() + s.size());
+    for (Token token = lexer.next(); token.type != Token::EndOfInput; token = lexer.next())
+    {
+        offsets.append(static_cast<quint32>(token.start - s.constData()));
+    }
+    return offsets;
+}
+
+void TestLuaParser::test_structuralIndex()
+{
+    // Braces and commas in strings and comments, and a string across a block boundary
+    const QByteArray tricky("s = { a = \"x{,}=\", -- c { \"q\n b = 1, { c = { -2.5, ZSTR \"$$$/x=y\" } },\r\n"
+                            "\"a string long enough to straddle the end of the second block {\", d=true; "
+                            "e = 'it''s \\' {', f = \"\\\"}\\\\\", --[==[ { ]] } ]==] [\"g h\"] = [[\n}]=]], "
+                            "[1] = 0x1F, --[[]]i = [=[{]]]=], j = 1e-3 }");
+    const QByteArray synthetic = syntheticTemplate(3).toUtf8();
+
+    for (const QByteArray &s : {tricky, synthetic, tricky.left(63), tricky.left(64), tricky.left(65)})
+    {
+        const QVector<quint32> expected = tokenOffsets(s);
+        for (const ScanIsa isa : {ScanIsa::Scalar, ScanIsa::Sse2, ScanIsa::Avx2, ScanIsa::Best})
+        {
+            if (!isaSupported(isa)) continue;
+            const StructuralIndex index(s.constData(), s.constData() + s.size(), isa);
+            QCOMPARE(index.offsets(), expected);
+        }
+    }
+
+    const StructuralIndex index(tricky.constData(), tricky.constData() + tricky.size());
+    const char *open = tricky.constData() + tricky.indexOf("{ c =");
+    const char *close = index.matchingBrace(open);
+    QVERIFY(close != nullptr);
+    QCOMPARE(QByteArray(open, static_cast<int>(close + 1 - open)), QByteArray("{ c = { -2.5, ZSTR \"$$$/x=y\" } }"));
+
+    // Only braces found by the scan can be matched
+    QVERIFY(index.matchingBrace(tricky.constData() + tricky.indexOf("{,}")) == nullptr);
+    const QByteArray unclosed("t = { {}");
+    QVERIFY(StructuralIndex(unclosed.constData(), unclosed.constData() + unclosed.size()).matchingBrace(unclosed.constData() + 4) == nullptr);
+}
+
 void TestLuaParser::test_dict()
 {
     const QString s =
@@ -293,6 +681,596 @@ void TestLuaParser::test_setAttr()
     QCOMPARE(t.getString("1/styleName"), QStringLiteral("dirty"));
 }
 
+void TestLuaParser::test_sharedTables()
+{
+    const NamedVariant nv = parseLuaStruct("s = { type = \"layoutStyle\", { styleName = \"clean\" }, { styleName = \"plain\" } }");
+    const Table t = nv.value().value<Table>();
+
+    // Copies, including those out of a QVariant, share until one is changed
+    Table copy = t;
+    QVERIFY(copy.isSharedWith(t));
+    QVERIFY(nv.value().value<Table>().isSharedWith(t));
+    QVERIFY(t.getTable("1").isSharedWith(t.getTable("1")));
+
+    copy.setString("1/styleName", "dirty");
+    QVERIFY(!copy.isSharedWith(t));
+    QCOMPARE(copy.getString("1/styleName"), QStringLiteral("dirty"));
+    QCOMPARE(t.getString("1/styleName"), QStringLiteral("clean"));
+
+    // Only the path that was changed is copied
+    QVERIFY(!copy.getTable("1").isSharedWith(t.getTable("1")));
+    QVERIFY(copy.getTable("2").isSharedWith(t.getTable("2")));
+
+    copy["type"] = "changed";
+    QCOMPARE(t.getString("type"), QStringLiteral("layoutStyle"));
+}
+
+void TestLuaParser::test_paths()
+{
+    const NamedVariant nv = parseLuaStruct("s = { pages = { { name = \"one\", { x = 1.5 } }, { name = \"two\", { x = 2.5 } } } }");
+    Table t = nv.value().value<Table>();
+
+    const Table::Path name("pages/2/name");
+    QCOMPARE(name.size(), 3);
+    QVERIFY(name.at(1).isIndex());
+    QVERIFY(name == (Table::Path{"pages", 2, "name"}));
+    QCOMPARE(name.toString(), QStringLiteral("pages/2/name"));
+    QCOMPARE(t.getString(name), QStringLiteral("two"));
+
+    // Paths can be reused and combined without reparsing
+    const Table::Path x("1/x");
+    for (int p = 1; p <= 2; p++)
+    {
+        const Table::Path page = Table::Path{"pages"} << p;
+        QCOMPARE(t.getDouble(page + x), t.getDouble("pages/" + QString::number(p) + "/1/x"));
+    }
+    QCOMPARE(t.getTable(Table::Path{"pages", 1}).getString(Table::Path{"name"}), QStringLiteral("one"));
+
+    t.setAttr(Table::Path{"pages", 1, 1, "x"}, 4.0);
+    QCOMPARE(t.getDouble("pages/1/1/x"), 4.0);
+    QCOMPARE(nv.value().value<Table>().getDouble("pages/1/1/x"), 1.5);
+
+    QVERIFY_EXCEPTION_THROWN(t.getAttr(Table::Path{"pages", 3}), QException);
+    QVERIFY_EXCEPTION_THROWN(t.getAttr(Table::Path{"missing"}), QException);
+}
+
+void TestLuaParser::test_ref()
+{
+    const NamedVariant nv = parseLuaStruct("s = { pages = { { name = \"one\", transform = { x = 1.5, y = 2 } } } }");
+    Table t = nv.value().value<Table>();
+    const Table before = t;
+
+    Value *name = t.ref(Table::Path("pages/1/name"));
+    QVERIFY(name != nullptr);
+    QCOMPARE(name->toString(), QStringLiteral("one"));
+    *name = "changed";
+    QCOMPARE(t.getString("pages/1/name"), QStringLiteral("changed"));
+
+    Table *transform = t.refTable(Table::Path("pages/1/transform"));
+    QVERIFY(transform != nullptr);
+    (*transform)["x"] = 3.0;
+    transform->setAttr(Table::Path{"y"}, 4);
+    QCOMPARE(t.getDouble("pages/1/transform/x"), 3.0);
+    QCOMPARE(t.getInt("pages/1/transform/y"), 4);
+    QCOMPARE(t.refTable(Table::Path()), &t);
+
+    // Editing in place only changes this table, not earlier copies
+    QCOMPARE(before.getString("pages/1/name"), QStringLiteral("one"));
+    QCOMPARE(before.getDouble("pages/1/transform/x"), 1.5);
+
+    // Missing entries, and paths through things that are not tables
+    QVERIFY(t.ref(Table::Path("pages/2")) == nullptr);
+    QVERIFY(t.ref(Table::Path("pages/1/missing")) == nullptr);
+    QVERIFY(t.ref(Table::Path("pages/1/name/x")) == nullptr);
+    QVERIFY(t.refTable(Table::Path("pages/1/name")) == nullptr);
+    QVERIFY_EXCEPTION_THROWN(t.setAttr("pages/1/missing", 1), QException);
+}
+
+void TestLuaParser::test_edits()
+{
+    const NamedVariant nv = parseLuaStruct("s = { pages = { { name = \"one\", transform = { x = 1.5, y = 2 } }, { name = \"two\" } } }");
+    Table t = nv.value().value<Table>();
+    const Table before = t;
+
+    Table::Edits edits;
+    edits.set(Table::Path("pages/2/name"), "second");
+    edits.set(Table::Path("pages/1/transform/y"), 4);
+    edits.set(Table::Path("pages/1/transform/x"), 3.0);
+    edits.set(Table::Path("pages/1/name"), "first");
+    edits.set(Table::Path("pages/1/name"), "last");
+    edits.set(Table::Path("pages/1/missing"), 1);
+    edits.set(Table::Path("pages/3/name"), "three");
+    edits.set(Table::Path("pages/2/name/x"), 1);
+    QCOMPARE(edits.size(), 8);
+
+    // The missing ones are skipped, rather than added
+    QCOMPARE(t.apply(edits), 5);
+    QCOMPARE(t.getString("pages/1/name"), QStringLiteral("last"));
+    QCOMPARE(t.getString("pages/2/name"), QStringLiteral("second"));
+    QCOMPARE(t.getDouble("pages/1/transform/x"), 3.0);
+    QCOMPARE(t.getInt("pages/1/transform/y"), 4);
+    QVERIFY(t.ref(Table::Path("pages/1/missing")) == nullptr);
+    QCOMPARE(t.getSequenceSize("pages"), 2);
+    QCOMPARE(before.getString("pages/1/name"), QStringLiteral("one"));
+
+    // Edits go in order, so one inside a table which is then replaced is lost
+    Table transform;
+    transform["x"] = 0;
+    edits.clear();
+    QVERIFY(edits.isEmpty());
+    edits.set(Table::Path("pages/1/transform/y"), 7);
+    edits.set(Table::Path("pages/1/transform"), transform);
+    edits.set(Table::Path("pages/1/transform/x"), 8);
+    edits.set(Table::Path("pages/2/name"), "2");
+    edits.set(Table::Path("pages/1/name"), "1");
+    QCOMPARE(t.apply(edits), 5);
+    QCOMPARE(t.getInt("pages/1/transform/x"), 8);
+    QVERIFY_EXCEPTION_THROWN(t.getInt("pages/1/transform/y"), QException);
+    QCOMPARE(t.getString("pages/1/name"), QStringLiteral("1"));
+    QCOMPARE(t.getString("pages/2/name"), QStringLiteral("2"));
+    QCOMPARE(transform.getInt("x"), 0);
+}
+
+void TestLuaParser::test_diff()
+{
+    const NamedVariant nv = parseLuaStruct("s = { pages = { { name = \"one\", transform = { x = 1.5, y = 2 } }, { name = \"two\" } }, "
+                                           "title = \"book\", size = 2.50 }");
+    const Table before = nv.value().value<Table>();
+    Table after = before;
+    QVERIFY(diff(before, after).isEmpty());
+
+    after.setAttr("pages/1/transform/x", 3);
+    after.setAttr("size", 2.5);  // The same number, written differently
+    after["title"] = Value();
+    after["subtitle"] = "new";
+    after.refTable(Table::Path("pages"))->append(Table());
+    Table::Path two("pages/2");
+    *after.ref(two) = Table();
+
+    const QVector<Change> changes = diff(before, after);
+    QCOMPARE(changes.size(), 5);
+
+    QCOMPARE(changes[0].kind, Change::Changed);
+    QCOMPARE(changes[0].path.toString(), QString("pages/1/transform/x"));
+    QCOMPARE(changes[0].before.toDouble(), 1.5);
+    QCOMPARE(changes[0].after.toInt(), 3);
+
+    QCOMPARE(changes[1].kind, Change::Removed);
+    QCOMPARE(changes[1].path.toString(), QString("pages/2/name"));
+    QCOMPARE(changes[1].before.toString(), QString("two"));
+    QVERIFY(changes[1].after.isNull());
+
+    QCOMPARE(changes[2].kind, Change::Added);
+    QCOMPARE(changes[2].path.toString(), QString("pages/3"));
+    QVERIFY(changes[2].after.table() != nullptr);
+
+    // A key set to nil is still there, but has changed
+    QCOMPARE(changes[3].kind, Change::Changed);
+    QCOMPARE(changes[3].path.toString(), QString("title"));
+
+    QCOMPARE(changes[4].kind, Change::Added);
+    QCOMPARE(changes[4].path, Table::Path{"subtitle"});
+    QCOMPARE(changes[4].after.toString(), QString("new"));
+
+    // The other way round
+    const QVector<Change> back = diff(after, before);
+    QCOMPARE(back.size(), 5);
+    QCOMPARE(back[2].kind, Change::Removed);
+    QCOMPARE(back[4].kind, Change::Removed);
+    QCOMPARE(back[4].path, Table::Path{"subtitle"});
+
+    // Equal tables which were built separately
+    Table reloaded = parseLuaStruct(LuaGenerator::Generate(nv)).value().value<Table>();
+    QVERIFY(diff(before, reloaded).isEmpty());
+    reloaded.setAttr("pages/2/name", "three");
+    const QVector<Change> edited = diff(before, reloaded);
+    QCOMPARE(edited.size(), 1);
+    QCOMPARE(edited[0].path.toString(), QString("pages/2/name"));
+}
+
+void TestLuaParser::test_contentHash()
+{
+    const NamedVariant nv = parseLuaStruct("s = { { x = 1, y = 2.50, name = \"photo\" }, { x = 1, y = 2.50, name = \"photo\" }, "
+                                           "{ name = \"photo\", y = 2.5, x = 1.0 }, { x = 1, y = 2.5, name = \"text\" }, "
+                                           "{ x = 1, y = 2.5, name = \"a name which is too long to keep in place\" } }");
+    Table t = nv.value().value<Table>();
+
+    // Equal tables hash the same, however their keys and numbers were written
+    QCOMPARE(t[1].table()->contentHash(), t[2].table()->contentHash());
+    QCOMPARE(t[1].table()->contentHash(), t[3].table()->contentHash());
+    QVERIFY(t[1].table()->contentHash() != t[4].table()->contentHash());
+    QCOMPARE(Value(1).contentHash(), Value(1.0).contentHash());
+    QCOMPARE(Value(0.0).contentHash(), Value(-0.0).contentHash());
+    QVERIFY(Value("1").contentHash() != Value(1).contentHash());
+    QVERIFY(Value("ZSTR:photo").contentHash() != Value("photo").contentHash());
+    QCOMPARE(Value(QString("a name which is too long to keep in place")).contentHash(), t[5].table()->getAttr("name").contentHash());
+    QVERIFY(Table().contentHash() != Value().contentHash());
+
+    const quint64 before = t.contentHash();
+    QCOMPARE(t.contentHash(), before);
+
+    // Edits at any depth, however they are made, are seen
+    t.setAttr("5/x", 2);
+    QVERIFY(t.contentHash() != before);
+    t.setAttr("5/x", 1);
+    QCOMPARE(t.contentHash(), before);
+    (*t.refTable(Table::Path("1")))["y"] = 3;
+    QVERIFY(t.contentHash() != before);
+    QVERIFY(t[1] != t[2]);
+    Table::Edits edits;
+    edits.set(Table::Path("1/y"), 2.5);
+    t.apply(edits);
+    QCOMPARE(t.contentHash(), before);
+    t.refTable(Table::Path("4"))->append(1);
+    QVERIFY(t.contentHash() != before);
+
+    // Including through a pointer which was taken before the hash was asked for
+    Table held = parseLuaStruct("s = { a = { x = 1 } }").value().value<Table>();
+    const Table other = parseLuaStruct("s = { a = { x = 2 } }").value().value<Table>();
+    Table *a = held.refTable(Table::Path("a"));
+    const quint64 one = held.contentHash();
+    QCOMPARE(held.contentHash(), one);
+    (*a)["x"] = 2;
+    QVERIFY(held.contentHash() != one);
+    QCOMPARE(held.contentHash(), other.contentHash());
+    QVERIFY(held == other);
+    Value *x = held.ref(Table::Path("a/x"));
+    QVERIFY(held == other);
+    *x = 3;
+    QVERIFY(held != other);
+    *x = 2;
+    QVERIFY(held == other);
+
+    // Copies keep the hash, and editing one leaves the other's alone
+    const Table copy = t;
+    const quint64 copied = copy.contentHash();
+    t[6] = Table();
+    QCOMPARE(copy.contentHash(), copied);
+    QVERIFY(t.contentHash() != copied);
+
+    // Tables can be used as keys
+    const Table original = nv.value().value<Table>();
+    QSet<Table> layouts;
+    for (int i = 1; i <= 5; i++) layouts.insert(*original[i].table());
+    QCOMPARE(layouts.size(), 3);
+}
+
+void TestLuaParser::test_pool()
+{
+    TablePool pool;
+    const NamedVariant a = pool.intern(parseLuaStruct(syntheticTemplate(3)));
+    const NamedVariant b = pool.intern(parseLuaStruct(syntheticTemplate(3)));
+    QCOMPARE(b.name(), QString("pages"));
+    Table ta = a.value().value<Table>();
+    const Table tb = b.value().value<Table>();
+
+    // Every page has the same six hints, but the transforms (so children and pages) differ
+    QVERIFY(ta.isSharedWith(tb));
+    QVERIFY(ta.getTable("pages/1/1/children/2/hints").isSharedWith(tb.getTable("pages/3/1/children/2/hints")));
+    QVERIFY(!ta.getTable("pages/1/1/children/1/hints").isSharedWith(ta.getTable("pages/1/1/children/2/hints")));
+    QCOMPARE(pool.size(), 3 + 3 * (3 + 6 * 2) + 6);
+
+    // A bigger template shares what it has in common
+    const Table tc = pool.intern(parseLuaStruct(syntheticTemplate(4)).value().value<Table>());
+    QVERIFY(!tc.isSharedWith(ta));
+    QVERIFY(tc.getTable("pages/2").isSharedWith(ta.getTable("pages/2")));
+
+    // Editing one copy leaves the pool, and the other copies, alone
+    const int size = pool.size();
+    ta.setAttr("pages/1/1/children/2/hints/photoIndex", 7);
+    QCOMPARE(tb.getInt("pages/1/1/children/2/hints/photoIndex"), 2);
+    QCOMPARE(tb.getInt("pages/3/1/children/2/hints/photoIndex"), 2);
+    QVERIFY(tb.isSharedWith(pool.intern(parseLuaStruct(syntheticTemplate(3)).value().value<Table>())));
+    QCOMPARE(pool.size(), size);
+
+    pool.clear();
+    QCOMPARE(pool.size(), 0);
+    QVERIFY(!tb.isSharedWith(pool.intern(tb.getTable("pages"))));
+}
+
+void TestLuaParser::test_query()
+{
+    const NamedVariant nv = parseLuaStruct(
+        "s = { pages = { { { children = { { placeholderType = \"photo\", hints = { photoIndex = 1 }, transform = { x = 1 } }, "
+        "                                  { placeholderType = \"text\", transform = { x = 2 } } } } }, "
+        "                { { children = { { placeholderType = \"text\", transform = { x = 3 } }, "
+        "                                  { placeholderType = \"photo\", hints = { photoIndex = 2 }, transform = { x = 4 } }, "
+        "                                  { placeholderType = \"photo\", hints = { photoIndex = 1 } } } } }, "
+        "                { name = \"no children\" } }, "
+        "      title = \"a/b [c]\" }");
+    const Table t = nv.value().value<Table>();
+
+    const Query all("pages/*/1/children/*/transform");
+    QCOMPARE(all.matches(t).count(), 4);
+
+    QVector<double> xs;
+    QVector<QVector<int>> indices;
+    for (const Query::Match &m : all.matches(t))
+    {
+        xs.append(m.value().table()->getDouble("x"));
+        indices.append(m.indices());
+    }
+    QCOMPARE(xs, QVector<double>({1, 2, 3, 4}));
+    QCOMPARE(indices.at(3), QVector<int>({2, 2}));
+
+    // Matches are the values in the table, not copies of them
+    auto first = all.matches(t).begin();
+    const Table *page = (*t["pages"].table())[1].table();
+    const Table *children = (*(*page)[1].table())["children"].table();
+    QCOMPARE(&first->value(), &(*(*children)[1].table())["transform"]);
+    QCOMPARE(first->path().toString(), QString("pages/1/1/children/1/transform"));
+
+    // Conditions
+    const Query photos("pages/*/1/children/*[placeholderType=\"photo\"]/transform/x");
+    xs.clear();
+    for (const Query::Match &m : photos.matches(t)) xs.append(m.value().toDouble());
+    QCOMPARE(xs, QVector<double>({1, 4}));
+
+    const Query firstPhotos("pages/*/1/children/*[placeholderType == \"photo\"][hints/photoIndex=1]");
+    QCOMPARE(firstPhotos.matches(t).count(), 2);
+    QCOMPARE(Query("pages/*[name=\"no children\"]").matches(t).count(), 1);
+    QCOMPARE(Query("pages/*/1/children/*[hints/photoIndex=2.0]/transform/x").matches(t).begin()->value().toInt(), 4);
+    QCOMPARE(Query("pages/*/1/children/*[missing=true]").matches(t).count(), 0);
+    QCOMPARE(Query("title").matches(t).begin()->value().toString(), QString("a/b [c]"));
+    QCOMPARE(Query("pages/2/1/children/3/transform").matches(t).count(), 0);
+    QCOMPARE(Query("pages/*/*").matches(t).count(), 2);
+    QVERIFY(Query().matches(t).begin() == Query().matches(t).end());
+    QVERIFY_EXCEPTION_THROWN(Query("pages/*[name]"), QException);
+    QVERIFY_EXCEPTION_THROWN(Query("pages/*[name=photo]"), QException);
+
+    // Bulk edits, found in one pass
+    Table edited = t;
+    Table::Edits edits;
+    for (const Query::Match &m : photos.matches(t)) edits.set(m.path(), m.value().toDouble() * 10);
+    QCOMPARE(edited.apply(edits), 2);
+    QCOMPARE(edited.getInt("pages/2/1/children/2/transform/x"), 40);
+    QCOMPARE(edited.getInt("pages/2/1/children/1/transform/x"), 3);
+}
+
+namespace
+{
+struct Photo
+{
+    QString name;
+    int index = 0;
+    double x = 0;
+    double y = 0;
+};
+
+constexpr Field<Photo> photoFields[] = {
+    {"name", [](Photo &p, const Value &v) { p.name = v.toString(); }, nullptr},
+    {"hints/photoIndex", [](Photo &p, const Value &v) { p.index = v.toInt(); }, [](const Photo &p) { return Value(p.index); }},
+    {"transform/x", [](Photo &p, const Value &v) { p.x = v.toDouble(); }, [](const Photo &p) { return Value(p.x); }},
+    {"transform/y", [](Photo &p, const Value &v) { p.y = v.toDouble(); }, [](const Photo &p) { return Value(p.y); }},
+};
+}  // namespace
+
+void TestLuaParser::test_schema()
+{
+    const NamedVariant nv = parseLuaStruct("s = { name = \"photo\", hints = { photoIndex = 2 }, transform = { y = 4, x = 3.5, angle = 0 } }");
+    Table t = nv.value().value<Table>();
+    const Table before = t;
+
+    const Schema<Photo> schema(photoFields);
+    Photo p;
+    QCOMPARE(schema.read(t, p), 4);
+    QCOMPARE(p.name, QString("photo"));
+    QCOMPARE(p.index, 2);
+    QCOMPARE(p.x, 3.5);
+    QCOMPARE(p.y, 4.0);
+
+    // Read-only fields are not written, and nothing else is touched
+    p.name = "changed";
+    p.x = 1;
+    QCOMPARE(schema.write(p, t), 1);
+    QCOMPARE(t.getString("name"), QString("photo"));
+    QCOMPARE(t.getDouble("transform/x"), 1.0);
+    QCOMPARE(t.getInt("transform/angle"), 0);
+    QCOMPARE(t.keys(), before.keys());
+    QCOMPARE(before.getDouble("transform/x"), 3.5);
+
+    // Missing fields are left alone when reading, and not added when writing
+    Table partial = parseLuaStruct("s = { transform = { x = 2 }, hints = 1 }").value().value<Table>();
+    Photo q;
+    q.y = -1;
+    QCOMPARE(schema.read(partial, q), 1);
+    QCOMPARE(q.x, 2.0);
+    QCOMPARE(q.y, -1.0);
+    QCOMPARE(q.index, 0);
+    QCOMPARE(schema.write(p, partial), 1);
+    QVERIFY(!partial.getTable("transform").contains(Atom("y")));
+
+    // Writing back what was read changes nothing, so numbers keep the text they were read from
+    const NamedVariant source = parseLuaStruct("s = { hints = { photoIndex = 2 }, transform = { x = 1.50, y = 348.12345678901234567 } }");
+    const Table original = source.value().value<Table>();
+    Table same = original;
+    Photo r;
+    schema.read(same, r);
+    QCOMPARE(schema.write(r, same), 0);
+    QVERIFY(same.isSharedWith(original));
+    QCOMPARE(LuaGenerator::Generate(same), LuaGenerator::Generate(original));
+    QVERIFY(LuaGenerator::Generate(same).contains("x = 1.50,"));
+    QVERIFY(LuaGenerator::Generate(same).contains("y = 348.12345678901234567,"));
+
+    // Only what has changed is written, and only the tables it is in are copied
+    r.x = 2;
+    QCOMPARE(schema.write(r, same), 1);
+    QCOMPARE(same.getDouble("transform/x"), 2.0);
+    QVERIFY(LuaGenerator::Generate(same).contains("y = 348.12345678901234567,"));
+    QVERIFY(same.getTable("hints").isSharedWith(original.getTable("hints")));
+    QCOMPARE(original.getAttr("transform/x").value<Number>().lexeme(), QByteArray("1.50"));
+}
+
+void TestLuaParser::test_history()
+{
+    Table t = parseLuaStruct(syntheticTemplate(50)).value().value<Table>();
+    TableHistory history(t);
+    QVERIFY(!history.canUndo());
+    QVERIFY(!history.canRedo());
+
+    // Each version is an edited copy of the one before
+    for (int p = 1; p <= 50; p++)
+    {
+        t.setAttr(Table::Path{"pages", p, 1, "children", 1, "transform", "x"}, -p);
+        history.push(t);
+    }
+    QCOMPARE(history.size(), 51);
+
+    // Only the values which changed are kept for each step, not whole versions
+    QCOMPARE(history.valueCount(), 2 * 50);
+
+    // Moving between versions only copies the tables along the paths edited
+    const Table last = history.current();
+    QCOMPARE(history.undo().getInt("pages/50/1/children/1/transform/x"), 501);
+    const Table before = history.current();
+    QVERIFY(!before.isSharedWith(last));
+    QVERIFY(before.getTable("hints").isSharedWith(last.getTable("hints")));
+    QVERIFY(before.getTable("pages/49").isSharedWith(last.getTable("pages/49")));
+    QVERIFY(before.getTable("pages/50/1/children/2").isSharedWith(last.getTable("pages/50/1/children/2")));
+    QVERIFY(!before.getTable("pages/50/1/children/1").isSharedWith(last.getTable("pages/50/1/children/1")));
+    QCOMPARE(diff(before, last).size(), 1);
+
+    while (history.canUndo()) history.undo();
+    QCOMPARE(history.current().getInt("pages/1/1/children/1/transform/x"), 11);
+    QCOMPARE(history.undo().getInt("pages/1/1/children/1/transform/x"), 11);
+    QCOMPARE(history.redo().getInt("pages/1/1/children/1/transform/x"), -1);
+    QCOMPARE(history.redo().getInt("pages/2/1/children/1/transform/x"), -2);
+    QVERIFY(history.canRedo());
+
+    // A new version drops those which could have been redone
+    Table branch = history.current();
+    branch.setAttr("hints/bookTitle", "Branch");
+    history.push(branch);
+    QVERIFY(!history.canRedo());
+    QCOMPARE(history.size(), 4);
+    QCOMPARE(history.redo().getString("hints/bookTitle"), QString("Branch"));
+    QCOMPARE(history.undo().getString("hints/bookTitle"), QString("Custom"));
+
+    // Entries added or removed are undone too, whichever table they are in
+    Table grown = history.current();
+    grown.refTable(Table::Path("pages"))->append(Table());
+    history.push(grown);
+    Table named = grown;
+    named["subtitle"] = "new";
+    history.push(named);
+    QCOMPARE(history.undo(), grown);
+    QVERIFY(history.current().find("subtitle") == nullptr);
+    QCOMPARE(history.undo().getSequenceSize("pages"), 50);
+    QCOMPARE(history.redo(), grown);
+    QCOMPARE(history.redo(), named);
+
+    history.reset(Table());
+    QCOMPARE(history.size(), 1);
+    QVERIFY(!history.canUndo());
+}
+
+void TestLuaParser::test_find()
+{
+    const Table t = parseLuaStruct(syntheticTemplate(2)).value().value<Table>();
+
+    QCOMPARE(t.find("hints")->table()->find("bookTitle")->toString(), QString("Custom"));
+    QCOMPARE(t.find(Atom("pages"))->table()->find(2)->table()->find(QString("name"))->toString(), QString("page2"));
+    QCOMPARE(t.find(Table::Path{"pages", 1, 1, "children", 6, "transform", "x"})->toInt(), 16);
+    QCOMPARE(t.find(Table::Path("pages/2/1/children/1/hints/photoIndex"))->toInt(), 1);
+
+    // Whatever is missing, there is no exception, just nothing found
+    QVERIFY(t.find(0) == nullptr);
+    QVERIFY(t.find(1) == nullptr);
+    QVERIFY(t.find("neverUsedAsAKey") == nullptr);
+    QVERIFY(t.find(Table::Path{"pages", 3}) == nullptr);
+    QVERIFY(t.find(Table::Path{"pages", 1, 1, "children", 1, "hints", "textIndex"}) == nullptr);
+    QVERIFY(t.find(Table::Path{"hints", "bookTitle", "x"}) == nullptr);
+
+    // A value is only got if it is there and is of the type asked for
+    QCOMPARE(t.tryGet<int>(Table::Path("pages/1/1/children/2/hints/photoIndex")).value_or(0), 2);
+    QCOMPARE(t.tryGet<QString>(Table::Path("hints/bookTitle")).value_or(QString()), QString("Custom"));
+    QVERIFY(!t.tryGet<int>(Table::Path("pages/1/1/children/2/hints/textIndex")).has_value());
+    QVERIFY(!t.tryGet<Table>(Table::Path("hints/bookTitle")).has_value());
+    QVERIFY(!t.tryGet<double>(Table::Path("hints")).has_value());
+    QVERIFY(t.tryGet<Table>(Table::Path("pages/2"))->isSharedWith(t.getTable("pages/2")));
+}
+
+void TestLuaParser::test_forEach()
+{
+    const NamedVariant nv = parseLuaStruct("t = { zebra = 1, \"a\", apple = { 2 }, 3.5, mango = \"m\" }");
+    const Table t = nv.value().value<Table>();
+
+    // Items first, then the keys in the order they were added
+    QStringList visited;
+    t.forEach([&](const Table::Entry &entry) {
+        QVERIFY(entry.kind == entry.value.kind());
+        QCOMPARE(&entry.value, entry.isIndex() ? t.find(entry.index) : t.find(*entry.key));
+        visited.append(entry.isIndex() ? QString::number(entry.index) : entry.key->toString());
+    });
+    QCOMPARE(visited.join(','), QString("1,2,zebra,apple,mango"));
+
+    int tables = 0, strings = 0;
+    t.forEach([&](const Table::Entry &entry) {
+        if (entry.kind == Value::Kind::Table) tables++;
+        if (entry.kind == Value::Kind::String) strings++;
+        QVERIFY(entry.segment() == (entry.isIndex() ? Table::Path::Segment(entry.index) : Table::Path::Segment(*entry.key)));
+    });
+    QCOMPARE(tables, 1);
+    QCOMPARE(strings, 2);
+
+    int count = 0;
+    Table().forEach([&count](const Table::Entry &) { count++; });
+    QCOMPARE(count, 0);
+}
+
+void TestLuaParser::test_values()
+{
+    // Two words with Qt 5's QString
+    if (sizeof(QString) == sizeof(void *)) QCOMPARE(static_cast<int>(sizeof(Value)), 16);
+
+    const NamedVariant nv = parseLuaStruct("s = { \"photo\", \"a string which is too long to keep in place\", ZSTR \"$$$/x=y\", "
+                                           "true, 3, 2.5, 2.50, { 1 }, \"caf\\195\\169\" }");
+    const Table t = nv.value().value<Table>();
+
+    QCOMPARE(t[1].kind(), Value::Kind::String);
+    QCOMPARE(t[1].toString(), QString("photo"));
+    QCOMPARE(t[2].toString(), QString("a string which is too long to keep in place"));
+    QCOMPARE(t[3].kind(), Value::Kind::ZString);
+    QCOMPARE(t[3].text(), QString("$$$/x=y"));
+    QCOMPARE(t[3].toString(), QString("ZSTR:$$$/x=y"));
+    QCOMPARE(t[4].kind(), Value::Kind::Bool);
+    QCOMPARE(t[5].kind(), Value::Kind::Int);
+    QCOMPARE(t[6].kind(), Value::Kind::Double);
+    QCOMPARE(t[7].kind(), Value::Kind::Number);
+    QCOMPARE(t[7].text(), QString("2.50"));
+    QCOMPARE(t[8].kind(), Value::Kind::Table);
+    QCOMPARE(t[8].table()->hash(), 1);
+    QVERIFY(t[1].table() == nullptr);
+    QCOMPARE(t[9].toString(), QString::fromUtf8("caf\xc3\xa9"));
+
+    // Numbers are equal whatever kind they are, strings and tables by contents
+    QVERIFY(t[6] == t[7]);
+    QVERIFY(t[5] == Value(3.0));
+    QVERIFY(t[1] == Value(QString("photo")));
+    QVERIFY(t[2] == Value::fromString("a string which is too long to keep in place"));
+    QVERIFY(t[3] != Value("$$$/x=y"));
+    QVERIFY(t[3] == Value("ZSTR:$$$/x=y"));
+    QVERIFY(t[8] == parseLuaStruct("s = { 1 }").value().value<Table>());
+    QVERIFY(Value() == Value());
+    QVERIFY(Value() != Value(0));
+
+    // Every kind survives a trip through QVariant
+    for (int i = 1; i <= t.hash(); i++)
+    {
+        const Value back = Value::fromVariant(t[i].toVariant());
+        QCOMPARE(back.kind(), t[i].kind());
+        QVERIFY(back == t[i]);
+    }
+
+    // Copies and moves leave the original as it was
+    Value a = t[2];
+    Value b = std::move(a);
+    QVERIFY(a.isNull());
+    QCOMPARE(b.toString(), t[2].toString());
+    a = t[7];
+    QCOMPARE(a.value<Number>().lexeme(), QByteArray("2.50"));
+}
+
 void TestLuaParser::test_file()
 {
     const QString path =
@@ -315,6 +1293,153 @@ void TestLuaParser::test_file()
     }
 }
 
+void TestLuaParser::test_readModes()
+{
+    // CRLF line endings and comments, as found in some hand-edited files
+    const QByteArray s(
+        "-- A comment\r\n"
+        "s = {\r\n"
+        "    -- Another comment\r\n"
+        "    title = \"two\r\nlines\",\r\n"
+        "    width = 495,\r\n"
+        "}\r\n");
+
+    const QString path = QDir::temp().filePath("tst_testluaparser_readmodes.lua");
+    {
+        QFile f(path);
+        QVERIFY(f.open(QIODevice::WriteOnly | QIODevice::Truncate));
+        f.write(s);
+    }
+
+    for (const auto mode : {ReadMode::Mapped, ReadMode::Buffered})
+    {
+        const NamedVariant nv = readLuaStruct(path, mode);
+        QCOMPARE(nv.name(), QString("s"));
+
+        const Table t = nv.value().value<Table>();
+        QCOMPARE(t.keys().size(), 2);
+        QCOMPARE(t.getString("title"), QString("two\nlines"));
+        QCOMPARE(t.getInt("width"), 495);
+    }
+
+    QFile::remove(path);
+}
+
+// Counts the pages and collects their preview names without building any tables
+class PageIndexer : public EventHandler
+{
+   public:
+    int depth = 0;
+    int pages = 0;
+    QStringList previews;
+    bool previewKey = false;
+
+    void onTableBegin() override
+    {
+        depth++;
+        // Items of the list at pages/pages
+        if (depth == 3) pages++;
+    }
+    void onKey(const Span &name, bool) override { previewKey = depth == 3 && name.equals("previewName"); }
+    void onNumber(const Span &, const Value &) override { previewKey = false; }
+    void onString(const Span &text, bool, bool) override
+    {
+        if (previewKey) previews.append(text.toString());
+        previewKey = false;
+    }
+    void onBool(bool) override { previewKey = false; }
+    void onTableEnd() override { depth--; }
+};
+
+void TestLuaParser::test_events()
+{
+    const QByteArray s = syntheticTemplate(20).toUtf8();
+
+    PageIndexer indexer;
+    QVERIFY(parseLuaEvents(s.constData(), s.constData() + s.size(), indexer));
+    QCOMPARE(indexer.depth, 0);
+    QCOMPARE(indexer.pages, 20);
+    QCOMPARE(indexer.previews.size(), 20);
+    QCOMPARE(indexer.previews.last(), QString("page20.jpg"));
+
+    // Errors are reported rather than thrown
+    const QByteArray bad("s = { x = }");
+    PageIndexer ignored;
+    QVERIFY(!parseLuaEvents(bad.constData(), bad.constData() + bad.size(), ignored));
+}
+
+void TestLuaParser::test_arenaDocument()
+{
+    const QString s = syntheticTemplate(20);
+
+    ArenaDocument doc;
+    QVERIFY(doc.setData(s.toUtf8()));
+    QCOMPARE(doc.name(), QString("pages"));
+    QCOMPARE(doc.getSequenceSize("pages"), 20);
+    QCOMPARE(doc.getSequenceSize(""), 0);
+    QCOMPARE(doc.getString("hints/bookTitle"), QString("Custom"));
+    QCOMPARE(doc.getDouble("pages/3/1/children/2/transform/x"), 32.0);
+    QCOMPARE(doc.getTable("pages/3").getString("previewName"), QString("page3.jpg"));
+    QVERIFY_EXCEPTION_THROWN(doc.getAttr("pages/21"), QException);
+
+    // Tables can be read where they are, rather than being copied out of the arena
+    const ArenaDocument::View page = doc.view(Table::Path("pages/3"));
+    QCOMPARE(page.getString("previewName"), QString("page3.jpg"));
+    QCOMPARE(page.getTable(Table::Path("1/children")).size(), 6);
+    QCOMPARE(page.getDouble("1/children/2/transform/x"), 32.0);
+    QCOMPARE(doc.view().getTable(Table::Path("pages")).size(), 20);
+    QCOMPARE(page.toTable(), doc.getTable("pages/3"));
+    QVERIFY_EXCEPTION_THROWN(doc.view(Table::Path("hints/bookTitle")), QException);
+    QVERIFY_EXCEPTION_THROWN(page.getTable(Table::Path("previewName")), QException);
+    QVERIFY_EXCEPTION_THROWN(doc.getAttr("hints/bookTitle/x"), QException);
+
+    // Everything is in a few blocks, rather than an allocation per value
+    QVERIFY(doc.arena().size() > 0);
+    QVERIFY(doc.arena().blockCount() < 20);
+
+    // The whole thing matches a full parse
+    QCOMPARE(LuaGenerator::Generate(doc.namedVariant()), LuaGenerator::Generate(parseLuaStruct(s)));
+
+    // Values of any kind can be replaced
+    doc.setAttr(Table::Path("pages/3/1/children/2/transform/x"), 33.5);
+    doc.setAttr(Table::Path("pages/3/previewName"), "a name which is longer than the one before");
+    doc.setAttr(Table::Path("pages/4"), parseLuaStruct("s = { a = { 1, ZSTR \"z\" } }").value().value<Table>());
+    QCOMPARE(doc.getDouble("pages/3/1/children/2/transform/x"), 33.5);
+    QCOMPARE(doc.getString("pages/3/previewName"), QString("a name which is longer than the one before"));
+    QCOMPARE(doc.getString("pages/4/a/2"), QString("ZSTR:z"));
+    QCOMPARE(doc.getSequenceSize("pages"), 20);
+    QCOMPARE(page.getString("previewName"), QString("a name which is longer than the one before"));
+
+    QVERIFY(!doc.setData("s = {"));
+    QVERIFY(doc.isEmpty());
+    QCOMPARE(doc.arena().blockCount(), 0);
+
+    // Alignment, and requests bigger than a block
+    Arena arena(64);
+    QCOMPARE(arena.copy("abc", "abc" + 3)[2], 'c');
+    QCOMPARE(reinterpret_cast<quintptr>(arena.allocate<double>(1)) % alignof(double), quintptr(0));
+    arena.allocate<char>(1000);
+    QCOMPARE(arena.size(), qint64(3 + 8 + 1000));
+}
+
+void TestLuaParser::test_parallel()
+{
+    const QByteArray s = syntheticTemplate(50).toUtf8();
+    const char *begin = s.constData();
+    const char *end = begin + s.size();
+
+    const NamedVariant serial = parseLuaStruct(begin, end, ThreadMode::Serial);
+    const NamedVariant parallel = parseLuaStruct(begin, end, ThreadMode::Parallel);
+    QCOMPARE(parallel.name(), serial.name());
+    QCOMPARE(LuaGenerator::Generate(parallel), LuaGenerator::Generate(serial));
+
+    // Errors inside a page are still found, and reported relative to the whole text
+    QByteArray bad(s);
+    const int where = bad.indexOf("placeholderType", bad.indexOf("page30"));
+    bad.replace(where, 15, "1placeholderTyp");
+    QVERIFY(parseLuaStruct(bad.constData(), bad.constData() + bad.size(), ThreadMode::Parallel).name().isEmpty());
+}
+
 void TestLuaParser::test_generator()
 {
     const QString s =
@@ -379,6 +1504,347 @@ void TestLuaParser::test_generator_mix()
     }
 }
 
+void TestLuaParser::test_keyOrder()
+{
+    // Not alphabetical, as Lightroom does not always write them that way
+    const QString s =
+        ("transform = {\n"
+         "   y = 348,\n"
+         "   x = 0,\n"
+         "   width = 580.09771728516,\n"
+         "   height = 435.5,\n"
+         "   angle = 0,\n"
+         "   }");
+
+    const NamedVariant nv = parseLuaStruct(s);
+    const Table transform = nv.value().value<Table>();
+    QCOMPARE(transform.keys(), QList<QString>({"y", "x", "width", "height", "angle"}));
+
+    const QStringList a = s.split('\n');
+    const QStringList b = LuaGenerator::Generate(nv).split('\n');
+    for (int i = 0; i < a.size(); i++) QCOMPARE(b[i].trimmed(), a[i].trimmed());
+
+    // The same entries, added in another order, are equal
+    Table other;
+    for (const char *key : {"angle", "height", "width", "x", "y"}) other[key] = transform[key];
+    QVERIFY(other == transform);
+    other["x"] = 1;
+    QVERIFY(other != transform);
+
+    // Enough keys that the table indexes them
+    Table big;
+    for (int i = 0; i < 100; i++) big[QString("key%1").arg(99 - i)] = i;
+    QCOMPARE(big.keys().size(), 100);
+    QCOMPARE(big.keys().first(), QString("key99"));
+    for (int i = 0; i < 100; i++) QCOMPARE(big[QString("key%1").arg(i)].toInt(), 99 - i);
+    big["key50"] = -1;
+    QCOMPARE(big.keys().size(), 100);
+    QCOMPARE(big.getInt("key50"), -1);
+}
+
+void TestLuaParser::benchmark_parse()
+{
+    const QString s = syntheticTemplate(500);
+
+    NamedVariant nv;
+    QBENCHMARK
+    {
+        nv = parseLuaStruct(s);
+    }
+
+    QCOMPARE(nv.value().value<Table>().getSequenceSize("pages"), 500);
+    QCOMPARE(nv.value().value<Table>().getDouble("pages/500/1/children/6/transform/x"), 5006.0);
+}
+
+// Loading and discarding a template, as when switching between books
+void TestLuaParser::benchmark_loadUnload()
+{
+    const QByteArray s = syntheticTemplate(500).toUtf8();
+
+    QBENCHMARK
+    {
+        const NamedVariant nv = parseLuaStruct(s.constData(), s.constData() + s.size(), ThreadMode::Serial);
+        QVERIFY(nv.value().isValid());
+    }
+}
+
+void TestLuaParser::benchmark_loadUnloadArena()
+{
+    const QByteArray s = syntheticTemplate(500).toUtf8();
+
+    QBENCHMARK
+    {
+        ArenaDocument doc;
+        QVERIFY(doc.setData(s));
+    }
+}
+
+void TestLuaParser::benchmark_parseParallel()
+{
+    const QByteArray s = syntheticTemplate(500).toUtf8();
+
+    NamedVariant nv;
+    QBENCHMARK
+    {
+        nv = parseLuaStruct(s.constData(), s.constData() + s.size(), ThreadMode::Parallel);
+    }
+
+    QCOMPARE(nv.value().value<Table>().getSequenceSize("pages"), 500);
+}
+
+void TestLuaParser::benchmark_generate()
+{
+    const NamedVariant nv = parseLuaStruct(syntheticTemplate(500));
+
+    QString text;
+    QBENCHMARK
+    {
+        text = LuaGenerator::Generate(nv);
+    }
+
+    QVERIFY(text.startsWith("pages = {"));
+}
+
+void TestLuaParser::benchmark_getAttr()
+{
+    const Table t = parseLuaStruct(syntheticTemplate(50)).value().value<Table>();
+
+    double total = 0;
+    QBENCHMARK
+    {
+        for (int p = 1; p <= 50; p++) total += t.getDouble("pages/" + QString::number(p) + "/1/children/3/transform/x");
+    }
+
+    QVERIFY(total > 0);
+}
+
+void TestLuaParser::benchmark_getAttrPath()
+{
+    const Table t = parseLuaStruct(syntheticTemplate(50)).value().value<Table>();
+
+    const Table::Path x("1/children/3/transform/x");
+    double total = 0;
+    QBENCHMARK
+    {
+        for (int p = 1; p <= 50; p++) total += t.getTable(Table::Path{"pages", p}).getDouble(x);
+    }
+
+    QVERIFY(total > 0);
+}
+
+// The positions a save writes for a template of this many pages
+static QVector<QPair<Table::Path, double>> savedPositions(int pages)
+{
+    QVector<QPair<Table::Path, double>> positions;
+    for (int p = 1; p <= pages; p++)
+    {
+        for (int c = 1; c <= 6; c++)
+        {
+            const Table::Path transform{"pages", p, 1, "children", c, "transform"};
+            for (const char *key : {"x", "y", "width", "height"}) positions.append(qMakePair(transform + Table::Path{key}, p + c * 0.5));
+        }
+    }
+    return positions;
+}
+
+void TestLuaParser::benchmark_setAttr()
+{
+    const NamedVariant nv = parseLuaStruct(syntheticTemplate(500));
+    Table t = nv.value().value<Table>();
+    const auto positions = savedPositions(500);
+
+    QBENCHMARK
+    {
+        for (const auto &position : positions) t.setAttr(position.first, position.second);
+    }
+
+    QCOMPARE(t.getDouble("pages/500/1/children/6/transform/x"), 503.0);
+}
+
+void TestLuaParser::benchmark_applyEdits()
+{
+    const NamedVariant nv = parseLuaStruct(syntheticTemplate(500));
+    Table t = nv.value().value<Table>();
+    const auto positions = savedPositions(500);
+
+    int applied = 0;
+    QBENCHMARK
+    {
+        Table::Edits edits;
+        for (const auto &position : positions) edits.set(position.first, position.second);
+        applied = t.apply(edits);
+    }
+
+    QCOMPARE(applied, positions.size());
+    QCOMPARE(t.getDouble("pages/500/1/children/6/transform/x"), 503.0);
+}
+
+void TestLuaParser::benchmark_diff()
+{
+    const Table before = parseLuaStruct(syntheticTemplate(500)).value().value<Table>();
+    Table after = before;
+    after.setAttr("pages/250/1/children/3/transform/x", 0);
+
+    QVector<Change> changes;
+    QBENCHMARK
+    {
+        changes = diff(before, after);
+    }
+
+    QCOMPARE(changes.size(), 1);
+    QCOMPARE(changes[0].path.toString(), QString("pages/250/1/children/3/transform/x"));
+}
+
+void TestLuaParser::benchmark_matchPages()
+{
+    // Every other page has the same layout as the one before it
+    const Table t = parseLuaStruct(syntheticTemplate(500)).value().value<Table>();
+    const Table pages = t.getTable("pages");
+    Table layouts;
+    for (int p = 1; p <= pages.hash(); p++) layouts.append(pages.getTable(QString("%1/1/children").arg((p + 1) / 2)));
+
+    int count = 0;
+    QBENCHMARK
+    {
+        QSet<Table> distinct;
+        for (int p = 1; p <= layouts.hash(); p++) distinct.insert(layouts.getTable(QString::number(p)));
+        count = distinct.size();
+    }
+
+    QCOMPARE(count, 250);
+}
+
+void TestLuaParser::benchmark_intern()
+{
+    const Table t = parseLuaStruct(syntheticTemplate(500)).value().value<Table>();
+
+    int size = 0;
+    QBENCHMARK
+    {
+        TablePool pool;
+        pool.intern(t);
+        size = pool.size();
+    }
+
+    // Only the six hints repeat
+    QCOMPARE(size, 3 + 500 * (3 + 6 * 2) + 6);
+}
+
+void TestLuaParser::benchmark_query()
+{
+    const Table t = parseLuaStruct(syntheticTemplate(500)).value().value<Table>();
+    const Query photos("pages/*/1/children/*[placeholderType=\"photo\"]/transform/x");
+
+    double total = 0;
+    QBENCHMARK
+    {
+        for (const Query::Match &m : photos.matches(t)) total += m.value().toDouble();
+    }
+
+    QVERIFY(total > 0);
+}
+
+void TestLuaParser::benchmark_probe()
+{
+    const Table t = parseLuaStruct(syntheticTemplate(500)).value().value<Table>();
+
+    // Each element has a photoIndex, none has a textIndex
+    const Table::Path photoIndex("hints/photoIndex"), textIndex("hints/textIndex");
+    int photos = 0, texts = 0;
+    QBENCHMARK
+    {
+        photos = texts = 0;
+        const Table &pages = *t.find("pages")->table();
+        for (int p = 1; p <= pages.hash(); p++)
+        {
+            const Table &children = *pages[p].table()->find(Table::Path{1, "children"})->table();
+            for (int c = 1; c <= children.hash(); c++)
+            {
+                const Table &element = *children[c].table();
+                if (element.find(photoIndex) != nullptr) photos++;
+                if (element.find(textIndex) != nullptr) texts++;
+            }
+        }
+    }
+
+    QCOMPARE(photos, 500 * 6);
+    QCOMPARE(texts, 0);
+}
+
+// Visits every value in a template, as the generator and snapshot writer do
+static int countValues(const Table &t)
+{
+    int n = 0;
+    t.forEach([&n](const Table::Entry &entry) { n += entry.kind == Value::Kind::Table ? countValues(*entry.value.table()) : 1; });
+    return n;
+}
+
+void TestLuaParser::benchmark_walk()
+{
+    const Table t = parseLuaStruct(syntheticTemplate(500)).value().value<Table>();
+
+    int n = 0;
+    QBENCHMARK
+    {
+        n = countValues(t);
+    }
+
+    QVERIFY(n > 0);
+}
+
+void TestLuaParser::benchmark_readSnapshot()
+{
+    const QByteArray snapshot = writeSnapshot(parseLuaStruct(syntheticTemplate(500)), SnapshotSource());
+
+    NamedVariant nv;
+    QBENCHMARK
+    {
+        readSnapshot(snapshot.constData(), snapshot.constData() + snapshot.size(), nv);
+    }
+
+    QCOMPARE(nv.value().value<Table>().getSequenceSize("pages"), 500);
+}
+
+// The scans below find the same token starts, the lexer being the baseline
+void TestLuaParser::benchmark_scanLexer()
+{
+    const QByteArray s = syntheticTemplate(500).toUtf8();
+
+    QVector<quint32> offsets;
+    QBENCHMARK
+    {
+        offsets = tokenOffsets(s);
+    }
+
+    QVERIFY(!offsets.isEmpty());
+}
+
+void TestLuaParser::benchmark_scanScalar()
+{
+    const QByteArray s = syntheticTemplate(500).toUtf8();
+
+    StructuralIndex index;
+    QBENCHMARK
+    {
+        index = StructuralIndex(s.constData(), s.constData() + s.size(), ScanIsa::Scalar);
+    }
+
+    QVERIFY(!index.offsets().isEmpty());
+}
+
+void TestLuaParser::benchmark_scanSimd()
+{
+    const QByteArray s = syntheticTemplate(500).toUtf8();
+
+    StructuralIndex index;
+    QBENCHMARK
+    {
+        index = StructuralIndex(s.constData(), s.constData() + s.size(), ScanIsa::Best);
+    }
+
+    QVERIFY(!index.offsets().isEmpty());
+}
+
 QTEST_APPLESS_MAIN(TestLuaParser)
 
 #include "tst_testluaparser.moc"